@@ -0,0 +1,574 @@
+#pragma once
+#include "common.hpp"
+#include "equations.hpp"
+#include "sample_cache.hpp"
+#include "sampler.hpp"
+#include "thread_pool.hpp"
+#include <atomic>
+#include <chrono>
+
+/*
+	Background curve sampling
+
+	The render thread submits requests (the view and a snapshot of the program) and keeps drawing the curves of the last completed request,
+	while a background thread samples them on the thread pool, so expensive equations don't stall frames.
+	Results are double buffered: the background thread builds a complete set of curves and only then swaps it with the ready set,
+	which the render thread swaps with the set it draws from (see poll).
+
+	Requests are sampled progressively: first with view.passes coarser passes (each 2x coarser, so 8x with 3), then at full resolution.
+	Each pass refines the curves in fixed chunks of x, the ones closest to focus_x (the cursor) first, and results get published
+	(at most every PUBLISH_MS) with every chunk at the finest pass done so far, so expensive curves show up coarse right away and fill in.
+	Chunk edges are at the same x in every pass (REFINE_CHUNK >> pass coarse intervals), so chunks of different passes line up.
+
+	A request replaces any request that did not start yet, and cancels the one in progress,
+	which then stops at its next evaluation, so while the camera moves only the latest view gets sampled.
+
+	Snapshots copy the code of the equations (and share their jit kernels), so the render thread can keep editing and rebuilding equations
+	while a request is in progress. Curves and errors are matched back to the equations by code_stamp.
+*/
+
+// the equations at the time of a request, built whenever Equations::update_code changed the program
+struct SampleProgram {
+	Evaluator eval; // functions point to the code in entries
+
+	struct Entry {
+		RegCode                    code;
+		std::shared_ptr<JitKernel> jit;
+		int                        code_stamp = -1;
+	};
+	std::vector<Entry> entries; // indexed like the equations
+
+	SampleProgram (Equations& equations, bool use_jit) {
+		ZoneScoped;
+
+		auto& prog = equations.program.eval;
+		int count = (int)equations.equations.size();
+
+		eval.share_program(prog);
+
+		entries.resize(count);
+		for (int eq_i=0; eq_i<count; ++eq_i) {
+			auto& eq = equations.equations[eq_i];
+			auto& e = entries[eq_i];
+
+			e.code_stamp = eq.code_stamp;
+			if (prog.functions[eq_i].code) {
+				e.code = *prog.functions[eq_i].code;
+				e.code.names.clear(); // already linked, only needed for debugging
+				e.jit = use_jit ? eq.jit : nullptr;
+
+				eval.functions[eq_i] = { nullptr, &e.code };
+			}
+		}
+	}
+};
+
+// samples within the view, see App::draw_equations
+struct SampleView {
+	int    level, start, end; // coarse samples
+	int    depth;
+	float  tol;
+	int    budget;
+	float2 cull_y;
+	bool   log_x, log_y;
+	int    passes; // coarser passes to sample first, see AsyncSampler
+
+	bool operator== (SampleView const& r) const {
+		return level == r.level && start == r.start && end == r.end && depth == r.depth && tol == r.tol && budget == r.budget &&
+			cull_y.x == r.cull_y.x && cull_y.y == r.cull_y.y && log_x == r.log_x && log_y == r.log_y && passes == r.passes;
+	}
+};
+
+struct SampleRequest {
+	int                                  id;
+	std::shared_ptr<SampleProgram const> program;
+	SampleView                           view;
+	std::vector<int>                     plot; // equations to sample
+	int                                  threads; // for the thread pool, 0: one per hardware thread
+	float                                focus_x; // refined first (plot space), only affects the order
+
+	// only requests that differ need to be sampled
+	bool same (SampleRequest const& r) const {
+		return program == r.program && view == r.view && plot == r.plot && threads == r.threads;
+	}
+};
+
+struct SampleResult {
+	int id = -1;
+
+	std::vector<SampledCurve> curves; // of the plotted equations, curve.key.code_stamp says which
+
+	struct Error {
+		int         code_stamp;
+		const char* err;
+	};
+	std::vector<Error> errors;
+
+	int   pass = 0;       // passes left after this result, 0 once complete
+	float progress = 1;   // of all refine jobs of the request
+
+	// for debugging
+	int   tile_jobs = 0, refine_jobs = 0;
+	int   evaluations = 0, bounds = 0, culled = 0, cuts = 0; // summed over all refine jobs
+	float time_ms = 0;
+
+	SampledCurve const* find (int code_stamp) const {
+		for (auto& c : curves) {
+			if (c.key.code_stamp == code_stamp)
+				return &c;
+		}
+		return nullptr;
+	}
+};
+
+struct AsyncSampler {
+	// uniform samples of all equations
+	SampleTiles sample_tiles;
+
+	// adaptively refined curve of each equation (indexed like the equations of the last request, the key contains the code_stamp, so reordering is safe)
+	std::vector<SampledCurve> curves;
+
+	// sampling is split into jobs by equation and x range, which run on all cores
+	// jobs only write their own results, which get merged in equation and x order, so the curves don't depend on the scheduling
+	WorkStealingPool pool;
+
+	// scratch data of each thread of the pool
+	struct SampleThread {
+		Evaluator                            eval; // shares the program of the request, with its own registers
+		std::shared_ptr<SampleProgram const> program; // kept alive, so that a new program can't reuse its address
+		AdaptiveSampler                      sampler;
+		std::vector<float>                   xs;
+	};
+	std::vector<SampleThread> sample_threads;
+
+	// a tile of uniform samples that was not cached
+	struct TileJob {
+		int              eq_i;
+		SampleTiles::Key key;
+		float            ys[SampleTiles::TILE_SIZE];
+		const char*      err;
+	};
+	// a chunk of the coarse samples of a curve to refine
+	struct RefineJob {
+		int                 eq_i;
+		int                 chunk; // index into Progress::chunks
+		int                 first, last; // coarse samples, the last one is also the first of the next chunk
+		int                 budget;
+		float               dist;  // of the chunk to focus_x
+		std::vector<float2> points;
+		const char*         err;
+		int                 evaluations, bounds, culled, cuts;
+	};
+	std::vector<TileJob>   tile_jobs;
+	std::vector<RefineJob> refine_jobs;
+
+	// curve of each plotted equation that is being sampled (indexed like the equations of the request)
+	struct Progress {
+		std::vector<float2>              coarse; // samples of the current pass
+		std::vector<std::vector<float2>> chunks; // refined points of each chunk, from the finest pass done so far
+		bool                             active; // being sampled, not cached or failed
+	};
+	std::vector<Progress> progress;
+
+	// coarse intervals per refine job at full resolution, small enough to spread a single curve over many threads
+	static constexpr int REFINE_CHUNK = 32;
+	// coarser passes need chunks with at least one interval
+	static constexpr int MAX_PASSES = 5;
+
+	static constexpr float PUBLISH_MS = 10.0f;
+
+	static constexpr const char* CANCELLED = "cancelled";
+
+	// Background thread and the hand off of requests and results (everything below is protected by mutex)
+	std::thread             thread;
+	std::mutex              mutex;
+	std::condition_variable cv;
+	bool                    quit = false;
+
+	std::unique_ptr<SampleRequest> pending; // latest request that did not start yet
+	int                            running = -1; // id of the request in progress
+	std::atomic<bool>              cancel {false}; // cancel the request in progress
+
+	SampleResult ready;         // latest completed result, not taken by poll yet
+	bool         has_ready = false;
+	int          ready_id = -1; // id of the latest completed (or cancelled) request
+
+	AsyncSampler () {
+		thread = std::thread(&AsyncSampler::background, this);
+	}
+	~AsyncSampler () {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			quit = true;
+			cancel = true;
+		}
+		cv.notify_all();
+		thread.join();
+	}
+
+	void submit (SampleRequest&& req) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			pending = std::make_unique<SampleRequest>(std::move(req));
+			if (running >= 0)
+				cancel = true;
+		}
+		cv.notify_all();
+	}
+
+	// swap in the latest completed result, if there is one
+	bool poll (SampleResult* front) {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!has_ready)
+			return false;
+		std::swap(*front, ready);
+		has_ready = false;
+		return true;
+	}
+	// block until a request is done, for at most ms (forever if < 0), returns false on timeout
+	bool wait (int id, float ms=-1) {
+		std::unique_lock<std::mutex> lock(mutex);
+		auto done = [&] () { return ready_id >= id; };
+		if (ms < 0) {
+			cv.wait(lock, done);
+			return true;
+		}
+		return cv.wait_for(lock, std::chrono::duration<float, std::milli>(ms), done);
+	}
+
+	bool busy () {
+		std::lock_guard<std::mutex> lock(mutex);
+		return pending || running >= 0;
+	}
+
+	void background () {
+		SampleResult back;
+
+		for (;;) {
+			std::unique_ptr<SampleRequest> req;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				cv.wait(lock, [&] () { return quit || pending; });
+				if (quit) return;
+
+				req = std::move(pending);
+				running = req->id;
+				cancel = false;
+			}
+
+			sample(*req, &back);
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				running = -1;
+				ready_id = req->id;
+			}
+			cv.notify_all();
+		}
+	}
+
+	void publish (SampleResult* back) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			std::swap(*back, ready);
+			has_ready = true;
+		}
+		cv.notify_all();
+	}
+
+	static int floor_div (int a, int b) {
+		return a >= 0 ? a / b : -((-a + b-1) / b);
+	}
+
+	// sample the curves of a request, publishing results while it progresses, stops early if cancelled
+	void sample (SampleRequest const& req, SampleResult* result) {
+		ZoneScoped;
+		auto t0 = std::chrono::high_resolution_clock::now();
+		auto ms_since = [] (std::chrono::high_resolution_clock::time_point t) {
+			return (float)std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t).count();
+		};
+
+		auto& prog = *req.program;
+		auto& v = req.view;
+		int passes = clamp(v.passes, 0, MAX_PASSES);
+
+		if (pool.thread_count() == 0 || (req.threads != 0 && req.threads != pool.thread_count()))
+			pool.start(req.threads);
+
+		sample_threads.resize(pool.thread_count());
+		for (auto& t : sample_threads) {
+			if (t.program != req.program) {
+				t.eval.share_program(prog.eval);
+				t.program = req.program;
+			}
+		}
+
+		curves.resize(prog.entries.size());
+		progress.resize(prog.entries.size());
+
+		auto curve_key = [&] (int eq_i) -> SampledCurve::Key {
+			return { prog.entries[eq_i].code_stamp, v.level, v.start, v.end, v.depth, v.tol, v.cull_y, v.log_x, v.log_y };
+		};
+
+		// run the jitted kernel if the equation compiled, else the interpreter (which also reports any errors)
+		auto evaluate = [&] (int eq_i, Evaluator& ev, float const* xs, float* ys, int count) -> const char* {
+			if (cancel)
+				return CANCELLED;
+
+			auto& e = prog.entries[eq_i];
+			if (e.jit) {
+				e.jit->run(xs, ys, count);
+				return nullptr;
+			}
+			return ev.execute_batch(e.code, xs, ys, count);
+		};
+
+		std::vector<SampleResult::Error> errors;
+		auto fail = [&] (int eq_i, const char* err) {
+			if (progress[eq_i].active && err != CANCELLED)
+				errors.push_back({ prog.entries[eq_i].code_stamp, err });
+			progress[eq_i].active = false;
+		};
+
+		// chunks are the same in every pass
+		int first_chunk = floor_div(v.start, REFINE_CHUNK);
+		int chunk_count = max(floor_div(v.end - 1, REFINE_CHUNK) - first_chunk + 1, 1);
+
+		// resample only if anything changed, so unaffected curves don't evaluate anything
+		int total_jobs = 0;
+		for (int eq_i : req.plot) {
+			auto& p = progress[eq_i];
+			p.active = !(curves[eq_i].key == curve_key(eq_i));
+			if (!p.active) continue;
+
+			curves[eq_i].key = {};
+			p.chunks.assign(chunk_count, {});
+			total_jobs += chunk_count * (passes + 1);
+		}
+
+		int done_jobs = 0;
+		int tile_count = 0, refine_count = 0;
+		int evaluations = 0, bounds = 0, culled = 0, cuts = 0;
+
+		auto build_result = [&] (int pass) {
+			result->id = req.id;
+			result->pass = pass;
+			result->progress = total_jobs > 0 ? (float)done_jobs / (float)total_jobs : 1.0f;
+			result->errors = errors;
+
+			result->tile_jobs   = tile_count;
+			result->refine_jobs = refine_count;
+			result->evaluations = evaluations;
+			result->bounds      = bounds;
+			result->culled      = culled;
+			result->cuts        = cuts;
+
+			result->curves.clear();
+			for (int eq_i : req.plot) {
+				auto& p = progress[eq_i];
+				if (!p.active) {
+					if (curves[eq_i].key == curve_key(eq_i))
+						result->curves.push_back(curves[eq_i]);
+					continue;
+				}
+
+				// merge the chunks in order, dropping the first point of each chunk after the first (it is the last point of the previous one)
+				SampledCurve curve;
+				curve.key = curve_key(eq_i);
+				for (auto& chunk : p.chunks)
+					curve.points.insert(curve.points.end(), chunk.begin() + (curve.points.empty() ? 0 : 1), chunk.end());
+				result->curves.push_back(std::move(curve));
+			}
+
+			result->time_ms = ms_since(t0);
+		};
+
+		auto last_publish = t0;
+
+		for (int pass=passes; pass>=0; --pass) {
+			ZoneScopedN("pass");
+
+			int level = v.level + pass;
+			float res = SampleTiles::spacing(level);
+			int start = floor_div(v.start, 1 << pass), end = -floor_div(-v.end, 1 << pass);
+			int step = REFINE_CHUNK >> pass; // coarse intervals per chunk
+
+			tile_jobs.clear();
+			refine_jobs.clear();
+
+			// coarse samples come from the tile cache, so pans over known ranges don't evaluate them again
+			for (int eq_i : req.plot) {
+				auto& p = progress[eq_i];
+				if (!p.active) continue;
+
+				p.coarse.clear();
+				for (int tile = SampleTiles::tile_of(start); tile <= SampleTiles::tile_of(end); ++tile) {
+					SampleTiles::Key key = { prog.entries[eq_i].code_stamp, level, tile, v.log_x, v.log_y };
+					float const* sample_ys = sample_tiles.lookup(key);
+					if (!sample_ys)
+						tile_jobs.push_back({ eq_i, key }); // filled in below
+
+					int first = tile * SampleTiles::TILE_SIZE;
+					int i0 = max(start - first, 0);
+					int i1 = min(end - first, SampleTiles::TILE_SIZE - 1);
+
+					for (int i=i0; i<=i1; ++i)
+						p.coarse.emplace_back((float)(first + i) * res, sample_ys ? sample_ys[i] : QNAN);
+				}
+			}
+
+			if (!tile_jobs.empty()) {
+				ZoneScopedN("sample tiles");
+
+				pool.run((int)tile_jobs.size(), [&] (int job_i, int thread) {
+					auto& job = tile_jobs[job_i];
+
+					float xs[SampleTiles::TILE_SIZE];
+					SampleTiles::tile_xs(job.key, xs);
+
+					job.err = evaluate(job.eq_i, sample_threads[thread].eval, xs, job.ys, SampleTiles::TILE_SIZE);
+					if (!job.err)
+						SampleTiles::to_plot(job.key, job.ys);
+				});
+				if (cancel) return;
+
+				for (auto& job : tile_jobs) {
+					if (job.err) {
+						fail(job.eq_i, job.err);
+						continue;
+					}
+					sample_tiles.store(job.key, job.ys);
+
+					int first = job.key.tile * SampleTiles::TILE_SIZE;
+					int i0 = max(start - first, 0);
+					int i1 = min(end - first, SampleTiles::TILE_SIZE - 1);
+
+					auto& coarse = progress[job.eq_i].coarse;
+					for (int i=i0; i<=i1; ++i)
+						coarse[first + i - start].y = job.ys[i];
+				}
+				tile_count += (int)tile_jobs.size();
+			}
+
+			// the budget is shared out by the number of intervals
+			for (int eq_i : req.plot) {
+				auto& p = progress[eq_i];
+				if (!p.active) continue;
+
+				int intervals = end - start;
+				for (int c=0; c<chunk_count; ++c) {
+					RefineJob job = {};
+					job.eq_i  = eq_i;
+					job.chunk = c;
+					job.first = clamp((first_chunk + c) * step - start, 0, intervals);
+					job.last  = clamp((first_chunk + c + 1) * step - start, 0, intervals);
+					job.budget = intervals > 0 ? (int)((int64_t)v.budget * (job.last - job.first) / intervals) : 0;
+
+					float x0 = p.coarse[job.first].x, x1 = p.coarse[job.last].x;
+					job.dist = req.focus_x < x0 ? x0 - req.focus_x : req.focus_x > x1 ? req.focus_x - x1 : 0.0f;
+					refine_jobs.push_back(std::move(job));
+				}
+			}
+
+			// most important chunks first
+			std::stable_sort(refine_jobs.begin(), refine_jobs.end(), [] (RefineJob const& l, RefineJob const& r) {
+				return l.dist < r.dist;
+			});
+
+			int batch = max(pool.thread_count() * 4, 1);
+			for (int b=0; b<(int)refine_jobs.size(); b += batch) {
+				ZoneScopedN("refine");
+
+				int count = min((int)refine_jobs.size() - b, batch);
+				pool.run(count, [&] (int job_i, int thread) {
+					auto& job = refine_jobs[b + job_i];
+					auto& t = sample_threads[thread];
+					auto& code = prog.entries[job.eq_i].code;
+
+					auto& coarse = progress[job.eq_i].coarse;
+					job.points.assign(coarse.begin() + job.first, coarse.begin() + job.last + 1);
+
+					// the sampler works in plot space
+					auto evaluate_plot = [&] (float const* xs, float* ys, int count) {
+						t.xs.resize(count);
+						for (int i=0; i<count; ++i)
+							t.xs[i] = v.log_x ? powf(10.0f, xs[i]) : xs[i];
+
+						job.err = evaluate(job.eq_i, t.eval, t.xs.data(), ys, count);
+						if (job.err)
+							return false;
+
+						if (v.log_y) {
+							for (int i=0; i<count; ++i)
+								ys[i] = log10f(ys[i]);
+						}
+						return true;
+					};
+					auto bound_plot = [&] (float x0, float x1, Interval* y) {
+						Interval x = v.log_x ? Interval(powf(10.0f, x0), powf(10.0f, x1)) : Interval(x0, x1);
+						if (t.eval.execute_interval(code, x, y))
+							return false;
+
+						if (v.log_y) {
+							// log10 is increasing, <= 0 is undefined (or -inf)
+							if (y->lo <= 0.0f) y->undef = true;
+							*y = y->hi <= 0.0f ? Interval::none() : ival_widen(ival_monotonic(Interval(max(y->lo, 0.0f), y->hi, y->undef), log10f), 4.0f);
+						}
+						return true;
+					};
+					t.sampler.refine(&job.points, v.tol, v.depth, job.budget, v.cull_y, evaluate_plot, bound_plot);
+
+					job.evaluations = t.sampler.evaluations;
+					job.bounds      = t.sampler.bounds;
+					job.culled      = t.sampler.culled;
+					job.cuts        = t.sampler.cuts;
+				});
+				if (cancel) return;
+
+				for (int i=b; i<b+count; ++i) {
+					auto& job = refine_jobs[i];
+					if (job.err) {
+						fail(job.eq_i, job.err);
+						continue;
+					}
+					if (progress[job.eq_i].active)
+						progress[job.eq_i].chunks[job.chunk] = std::move(job.points);
+
+					evaluations += job.evaluations;
+					bounds      += job.bounds;
+					culled      += job.culled;
+					cuts        += job.cuts;
+				}
+				done_jobs += count;
+				refine_count += count;
+
+				// curves are only complete after the first pass, intermediate results are throttled
+				bool pass_done = b + count >= (int)refine_jobs.size();
+				if (pass > 0 && ((pass_done && pass == passes) || (pass < passes && ms_since(last_publish) >= PUBLISH_MS))) {
+					build_result(pass);
+					publish(result);
+					last_publish = std::chrono::high_resolution_clock::now();
+				}
+			}
+		}
+
+		// cache the complete curves, so that unchanged equations don't get sampled again
+		for (int eq_i : req.plot) {
+			auto& p = progress[eq_i];
+			if (!p.active) continue;
+
+			auto& curve = curves[eq_i];
+			curve.points.clear();
+			for (auto& chunk : p.chunks)
+				curve.points.insert(curve.points.end(), chunk.begin() + (curve.points.empty() ? 0 : 1), chunk.end());
+			curve.key = curve_key(eq_i);
+
+			p.active = false;
+			p.chunks.clear();
+		}
+
+		done_jobs = total_jobs;
+		build_result(0);
+		publish(result);
+	}
+};
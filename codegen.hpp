@@ -30,7 +30,7 @@ inline bool constant_folding (ASTNode* node) {
 	switch (node->op.code) {
 		case OP_FUNCCALL: {
 			assert((int)values.size() == node->op.argc);
-			if (call_const_func(node->op, values.data(), &value))
+			if (!call_const_func(node->op, values.data(), &value))
 				return false;
 		} break;
 
@@ -64,12 +64,736 @@ inline bool constant_folding (ASTNode* node) {
 	node->op.code = OP_VALUE;
 	node->op.value = value;
 	node->op.text = std::string_view();
+	node->op.sym = NO_SYMBOL;
 
 	node->child = nullptr;
 
 	return true;
 }
 
+inline ast_ptr clone_ast (BlockBumpAllocator& allocator, ASTNode const* node) {
+	ast_ptr copy = alloc_ast_node(allocator, node->op.code);
+	copy->op = node->op;
+
+	ast_ptr* link = &copy->child;
+	for (auto* cur = GET_AST_PTR(node->child); cur; cur = GET_AST_PTR(cur->next)) {
+		*link = clone_ast(allocator, cur);
+		link = &(*link)->next;
+	}
+	return copy;
+}
+
+inline int count_ast_nodes (ASTNode const* node) {
+	int count = 1;
+	for (auto* cur = GET_AST_PTR(node->child); cur; cur = GET_AST_PTR(cur->next))
+		count += count_ast_nodes(cur);
+	return count;
+}
+
+/*
+	AST optimizer, runs after constant_folding if Equation::optimize is on
+	  identities          x*1 -> x   x+0 -> x   x-0 -> x   x/1 -> x   x^1 -> x   x^0 -> 1   --x -> x   -1*x -> -x
+	  negations           x + -y -> x - y   x - -y -> x + y   -x * -y -> x*y   c * -x -> -c * x
+	  strength reduction  x/c -> (1/c)*x   x^n -> chain of multiplies (integer -8 <= n <= 8, the copies of x are merged again by CSE)
+	  reassociation       constants are moved to the left of + and * and pulled up through chains of them
+	                      so that they meet and fold, ex. 2*x*3 -> 6*x   (x+1)-3 -> -2+x
+	x*0 -> 0 is not done since it's not nan-safe (inf*0 = nan)
+	reciprocals and reassociation can change the rounding of results slightly, which is fine for plotting
+*/
+struct ASTOptimizer {
+	BlockBumpAllocator& allocator;
+
+	static bool is_const (ASTNode const* node) {
+		return node->op.code == OP_VALUE;
+	}
+	static bool is_const (ASTNode const* node, float value) {
+		return node->op.code == OP_VALUE && node->op.value == value;
+	}
+
+	static ASTNode* arg0 (ASTNode* node) { return GET_AST_PTR(node->child); }
+	static ASTNode* arg1 (ASTNode* node) { return GET_AST_PTR(node->child->next); }
+
+	// detach the operands of a node to relink them
+	static void take_operand (ASTNode* node, ast_ptr* a) {
+		*a = std::move(node->child);
+		node->child = nullptr;
+	}
+	static void take_operands (ASTNode* node, ast_ptr* a, ast_ptr* b) {
+		*a = std::move(node->child);
+		*b = std::move((*a)->next);
+		(*a)->next = nullptr;
+		node->child = nullptr;
+	}
+	static void set_operand (ASTNode* node, OPType code, ast_ptr a) {
+		node->op.code = code;
+		a->next = nullptr;
+		node->child = std::move(a);
+	}
+	static void set_operands (ASTNode* node, OPType code, ast_ptr a, ast_ptr b) {
+		node->op.code = code;
+		a->next = std::move(b);
+		node->child = std::move(a);
+	}
+	// replace node with a detached node, keeping the position of node in the tree
+	static void replace (ASTNode* node, ast_ptr with) {
+		node->op = with->op;
+		ast_ptr children = std::move(with->child);
+		node->child = std::move(children);
+	}
+	// replace node with one of its operands
+	static void hoist (ASTNode* node, int operand) {
+		ast_ptr a, b;
+		take_operands(node, &a, &b);
+		replace(node, std::move(operand == 0 ? a : b));
+	}
+	static void swap_operands (ASTNode* node) {
+		ast_ptr a, b;
+		take_operands(node, &a, &b);
+		set_operands(node, node->op.code, std::move(b), std::move(a));
+	}
+
+	ast_ptr value_node (float value) {
+		ast_ptr node = alloc_ast_node(allocator, OP_VALUE);
+		node->op.value = value;
+		return node;
+	}
+	ast_ptr binary_node (OPType code, ast_ptr a, ast_ptr b) {
+		ast_ptr node = alloc_ast_node(allocator, code);
+		set_operands(GET_AST_PTR(node), code, std::move(a), std::move(b));
+		return node;
+	}
+	ast_ptr clone (ASTNode const* node) {
+		return clone_ast(allocator, node);
+	}
+
+	// x^n as multiplies, in the same order as lanes_pow (so results match the batch evaluator exactly)
+	ast_ptr pow_chain (ASTNode const* base, int n) {
+		ast_ptr res = nullptr;
+		ast_ptr b = clone(base);
+		for (int e = n < 0 ? -n : n; e; e >>= 1) {
+			if (e & 1)
+				res = res ? binary_node(OP_MULTIPLY, std::move(res), clone(GET_AST_PTR(b))) : clone(GET_AST_PTR(b));
+			if (e > 1) {
+				ast_ptr b2 = clone(GET_AST_PTR(b));
+				b = binary_node(OP_MULTIPLY, std::move(b), std::move(b2));
+			}
+		}
+		if (n < 0)
+			res = binary_node(OP_DIVIDE, value_node(1.0f), std::move(res));
+		return res;
+	}
+
+	// rules for + and *, which are commutative and associative
+	// canonical form has the constant (if any) as the left operand
+	bool simplify_assoc (ASTNode* node) {
+		OPType code = node->op.code;
+		ASTNode* a = arg0(node);
+		ASTNode* b = arg1(node);
+
+		if (is_const(b) && !is_const(a)) {
+			swap_operands(node);
+			return true;
+		}
+		if (is_const(a, code == OP_ADD ? 0.0f : 1.0f)) {
+			hoist(node, 1);
+			return true;
+		}
+		// c1 op (c2 op x) -> (c1 op c2) op x
+		if (is_const(a) && b->op.code == code && is_const(arg0(b))) {
+			float c2 = arg0(b)->op.value;
+			a->op.value = code == OP_ADD ? a->op.value + c2 : a->op.value * c2;
+
+			ast_ptr ap, bp, cp, xp;
+			take_operands(node, &ap, &bp);
+			take_operands(GET_AST_PTR(bp), &cp, &xp);
+			set_operands(node, code, std::move(ap), std::move(xp));
+			return true;
+		}
+		// (c op x) op y -> c op (x op y)   and   x op (c op y) -> c op (x op y)
+		if (!is_const(a)) {
+			bool left  = a->op.code == code && is_const(arg0(a));
+			bool right = b->op.code == code && is_const(arg0(b));
+			if (left || right) {
+				ast_ptr ap, bp;
+				take_operands(node, &ap, &bp);
+
+				// reuse the inner node for (x op y)
+				ast_ptr& inner = left ? ap : bp;
+				ast_ptr& other = left ? bp : ap;
+
+				ast_ptr cp, xp;
+				take_operands(GET_AST_PTR(inner), &cp, &xp);
+				if (left) set_operands(GET_AST_PTR(inner), code, std::move(xp), std::move(other));
+				else      set_operands(GET_AST_PTR(inner), code, std::move(other), std::move(xp));
+				simplify_all(GET_AST_PTR(inner));
+
+				set_operands(node, code, std::move(cp), std::move(inner));
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// apply one rule to node, returns true if node was changed
+	// operands are already simplified
+	bool simplify (ASTNode* node) {
+		OPType code = node->op.code;
+		if (code == OP_VALUE || code == OP_VARIABLE || code == OP_FUNCCALL)
+			return false;
+
+		ASTNode* a = arg0(node);
+		ASTNode* b = code == OP_UNARY_NEGATE ? nullptr : arg1(node);
+
+		if (is_const(a) && (!b || is_const(b)))
+			return constant_folding(node);
+
+		switch (code) {
+			case OP_UNARY_NEGATE: {
+				if (a->op.code == OP_UNARY_NEGATE) { // --x -> x
+					ast_ptr ap;
+					take_operand(node, &ap);
+					hoist(GET_AST_PTR(ap), 0);
+					replace(node, std::move(ap));
+					return true;
+				}
+				if ((a->op.code == OP_MULTIPLY || a->op.code == OP_DIVIDE) && is_const(arg0(a))) { // -(c*x) -> -c*x
+					arg0(a)->op.value = -arg0(a)->op.value;
+					ast_ptr ap;
+					take_operand(node, &ap);
+					replace(node, std::move(ap));
+					return true;
+				}
+			} break;
+
+			case OP_ADD: {
+				if (simplify_assoc(node))
+					return true;
+
+				if (b->op.code == OP_UNARY_NEGATE) { // x + -y -> x - y
+					ast_ptr ap, bp;
+					take_operands(node, &ap, &bp);
+					hoist(GET_AST_PTR(bp), 0);
+					set_operands(node, OP_SUBSTRACT, std::move(ap), std::move(bp));
+					return true;
+				}
+				if (a->op.code == OP_UNARY_NEGATE) { // -x + y -> y - x
+					ast_ptr ap, bp;
+					take_operands(node, &ap, &bp);
+					hoist(GET_AST_PTR(ap), 0);
+					set_operands(node, OP_SUBSTRACT, std::move(bp), std::move(ap));
+					return true;
+				}
+				if (is_const(a) && b->op.code == OP_SUBSTRACT && is_const(arg0(b))) { // c1 + (c2 - x) -> (c1+c2) - x
+					arg0(b)->op.value += a->op.value;
+					hoist(node, 1);
+					return true;
+				}
+			} break;
+
+			case OP_SUBSTRACT: {
+				if (is_const(b)) { // x - c -> -c + x
+					b->op.value = -b->op.value;
+					swap_operands(node);
+					node->op.code = OP_ADD;
+					return true;
+				}
+				if (is_const(a, 0.0f)) { // 0 - x -> -x
+					ast_ptr ap, bp;
+					take_operands(node, &ap, &bp);
+					set_operand(node, OP_UNARY_NEGATE, std::move(bp));
+					return true;
+				}
+				if (b->op.code == OP_UNARY_NEGATE) { // x - -y -> x + y
+					ast_ptr ap, bp;
+					take_operands(node, &ap, &bp);
+					hoist(GET_AST_PTR(bp), 0);
+					set_operands(node, OP_ADD, std::move(ap), std::move(bp));
+					return true;
+				}
+				// (c + x) - y -> c + (x - y)   and   x - (c + y) -> -c + (x - y)
+				bool left  = a->op.code == OP_ADD && is_const(arg0(a));
+				bool right = b->op.code == OP_ADD && is_const(arg0(b));
+				if (left || right) {
+					ast_ptr ap, bp;
+					take_operands(node, &ap, &bp);
+
+					ast_ptr& inner = left ? ap : bp;
+					ast_ptr& other = left ? bp : ap;
+
+					ast_ptr cp, xp;
+					take_operands(GET_AST_PTR(inner), &cp, &xp);
+					if (right) cp->op.value = -cp->op.value;
+
+					if (left) set_operands(GET_AST_PTR(inner), OP_SUBSTRACT, std::move(xp), std::move(other));
+					else      set_operands(GET_AST_PTR(inner), OP_SUBSTRACT, std::move(other), std::move(xp));
+					simplify_all(GET_AST_PTR(inner));
+
+					set_operands(node, OP_ADD, std::move(cp), std::move(inner));
+					return true;
+				}
+			} break;
+
+			case OP_MULTIPLY: {
+				if (simplify_assoc(node))
+					return true;
+
+				if (is_const(a, -1.0f)) { // -1 * x -> -x
+					ast_ptr ap, bp;
+					take_operands(node, &ap, &bp);
+					set_operand(node, OP_UNARY_NEGATE, std::move(bp));
+					return true;
+				}
+				if (b->op.code == OP_UNARY_NEGATE && (is_const(a) || a->op.code == OP_UNARY_NEGATE)) { // c * -x -> -c * x   -x * -y -> x * y
+					ast_ptr ap, bp;
+					take_operands(node, &ap, &bp);
+					if (is_const(GET_AST_PTR(ap))) ap->op.value = -ap->op.value;
+					else                           hoist(GET_AST_PTR(ap), 0);
+					hoist(GET_AST_PTR(bp), 0);
+					set_operands(node, OP_MULTIPLY, std::move(ap), std::move(bp));
+					return true;
+				}
+				if (is_const(a) && b->op.code == OP_DIVIDE && is_const(arg0(b))) { // c1 * (c2 / x) -> (c1*c2) / x
+					arg0(b)->op.value *= a->op.value;
+					hoist(node, 1);
+					return true;
+				}
+			} break;
+
+			case OP_DIVIDE: {
+				if (is_const(b)) { // x / c -> (1/c) * x
+					float recip = 1.0f / b->op.value;
+					// only if 1/c is representable, so that x * (1/c) stays close to x / c (1 ulp)
+					if (std::isnormal(b->op.value) && std::isnormal(recip)) {
+						b->op.value = recip;
+						swap_operands(node);
+						node->op.code = OP_MULTIPLY;
+						return true;
+					}
+				}
+				if (a->op.code == OP_MULTIPLY && is_const(arg0(a))) { // (c * x) / y -> c * (x / y)
+					ast_ptr ap, bp, cp, xp;
+					take_operands(node, &ap, &bp);
+					take_operands(GET_AST_PTR(ap), &cp, &xp);
+					set_operands(GET_AST_PTR(ap), OP_DIVIDE, std::move(xp), std::move(bp));
+					simplify_all(GET_AST_PTR(ap));
+					set_operands(node, OP_MULTIPLY, std::move(cp), std::move(ap));
+					return true;
+				}
+				if (is_const(a) && b->op.code == OP_MULTIPLY && is_const(arg0(b))) { // c1 / (c2 * x) -> (c1/c2) / x
+					a->op.value /= arg0(b)->op.value;
+					ast_ptr ap, bp, cp, xp;
+					take_operands(node, &ap, &bp);
+					take_operands(GET_AST_PTR(bp), &cp, &xp);
+					set_operands(node, OP_DIVIDE, std::move(ap), std::move(xp));
+					return true;
+				}
+			} break;
+
+			case OP_POW: {
+				if (!is_const(b)) break;
+				float n = b->op.value;
+
+				if (n == 1.0f) { // x^1 -> x
+					hoist(node, 0);
+					return true;
+				}
+				if (n == 0.0f) { // x^0 -> 1 (powf returns 1 even for nan)
+					replace(node, value_node(1.0f));
+					return true;
+				}
+				if (n >= -8.0f && n <= 8.0f && n == (float)(int)n) {
+					replace(node, pow_chain(a, (int)n));
+					return true;
+				}
+			} break;
+		}
+		return false;
+	}
+
+	void simplify_all (ASTNode* node) {
+		while (simplify(node))
+			;
+	}
+
+	void optimize (ASTNode* node) {
+		for (auto* cur = GET_AST_PTR(node->child); cur; cur = GET_AST_PTR(cur->next))
+			optimize(cur);
+
+		simplify_all(node);
+	}
+};
+
+/*
+	Function inlining
+	replaces calls to user functions with a copy of the function's formula, with the call arguments substituted for its arguments
+	lookup(sym, argc, &callee_def, &callee_formula) decides which calls get inlined, returning false keeps the call
+	the result should go through the optimizer and CSE, which merge arguments that the callee uses more than once
+*/
+struct Inliner {
+	BlockBumpAllocator& allocator;
+	EquationDef const&  def; // of the caller
+
+	ast_ptr substitute (ASTNode const* node, EquationDef const& callee, std::vector<ASTNode const*> const& args) {
+		if (node->op.code == OP_VARIABLE) {
+			int arg = callee.find_arg(node->op.sym);
+			if (arg >= 0)
+				return clone_ast(allocator, args[arg]);
+		}
+
+		ast_ptr copy = alloc_ast_node(allocator, node->op.code);
+		copy->op = node->op;
+
+		ast_ptr* link = &copy->child;
+		for (auto* cur = GET_AST_PTR(node->child); cur; cur = GET_AST_PTR(cur->next)) {
+			*link = substitute(cur, callee, args);
+			link = &(*link)->next;
+		}
+		return copy;
+	}
+
+	// a global name in the callee would resolve to an argument of the caller if it has the same name
+	bool captures_name (ASTNode const* node, EquationDef const& callee) {
+		if (node->op.code == OP_VARIABLE && callee.find_arg(node->op.sym) < 0 && def.find_arg(node->op.sym) >= 0)
+			return true;
+
+		for (auto* cur = GET_AST_PTR(node->child); cur; cur = GET_AST_PTR(cur->next)) {
+			if (captures_name(cur, callee))
+				return true;
+		}
+		return false;
+	}
+
+	// returns the number of inlined calls
+	template <typename LOOKUP>
+	int inline_calls (ASTNode* node, LOOKUP& lookup) {
+		int count = 0;
+		for (auto* cur = GET_AST_PTR(node->child); cur; cur = GET_AST_PTR(cur->next))
+			count += inline_calls(cur, lookup);
+
+		if (node->op.code != OP_FUNCCALL || find_builtin(node->op.sym))
+			return count;
+
+		EquationDef const* callee;
+		ASTNode const* formula;
+		if (!lookup(node->op.sym, node->op.argc, &callee, &formula) || captures_name(formula, *callee))
+			return count;
+
+		std::vector<ASTNode const*> args;
+		for (auto* cur = GET_AST_PTR(node->child); cur; cur = GET_AST_PTR(cur->next))
+			args.push_back(cur);
+
+		ast_ptr body = substitute(formula, *callee, args);
+		ASTOptimizer::replace(node, std::move(body));
+		return count + 1;
+	}
+};
+
+// replace names of variables with their values, where lookup(sym, &value) knows them
+// returns the number of substituted names, constant_folding and the optimizer can then simplify further
+template <typename LOOKUP>
+inline int substitute_variables (ASTNode* node, EquationDef const& def, LOOKUP& lookup) {
+	if (node->op.code == OP_VARIABLE) {
+		float value;
+		if (def.find_arg(node->op.sym) >= 0 || !lookup(node->op.sym, &value))
+			return 0;
+
+		node->op.code = OP_VALUE;
+		node->op.value = value;
+		node->op.text = std::string_view();
+		node->op.sym = NO_SYMBOL;
+		return 1;
+	}
+
+	int count = 0;
+	for (auto* cur = GET_AST_PTR(node->child); cur; cur = GET_AST_PTR(cur->next))
+		count += substitute_variables(cur, def, lookup);
+	return count;
+}
+
+/*
+	Symbolic differentiation
+	builds the AST of the derivative of a formula with respect to one of its arguments, other arguments and variables are constants
+	  + - * / and ^ by the usual rules (power and exponential rule if the exponent or base is constant)
+	  std functions by their derivatives, with the DegreeMode applied like the evaluators do (sin(x) is sinf(x * from_deg_x))
+	  abs(u)' = sign(u) * u'   min(a,b) = (a+b)/2 - |a-b|/2 (max, clamp alike)   which give the average of both sides at their kinks
+	  sign, floor, ceil and round are 0 (except at their jumps)
+	calls to user functions need to be inlined first (see derivative_ast)
+	terms that are 0 or 1 are folded as the derivative gets built, so that it stays small even without the optimizer
+*/
+struct Differentiator {
+	BlockBumpAllocator& allocator;
+	Symbol              var; // argument to differentiate by
+	DegreeMode          deg_mode;
+	std::string&        last_err;
+	bool                failed = false;
+
+	static bool is_const (ASTNode const* node, float value) {
+		return node->op.code == OP_VALUE && node->op.value == value;
+	}
+
+	ast_ptr value (float value) {
+		ast_ptr node = alloc_ast_node(allocator, OP_VALUE);
+		node->op.value = value;
+		return node;
+	}
+	ast_ptr clone (ASTNode const* node) {
+		return clone_ast(allocator, node);
+	}
+	// call of a std function (see builtin_symbols)
+	ast_ptr call (Symbol func, ast_ptr a, ast_ptr b=nullptr) {
+		ast_ptr node = alloc_ast_node(allocator, OP_FUNCCALL);
+		node->op.text = symbols.name(func);
+		node->op.sym = func;
+		node->op.argc = b ? 2 : 1;
+		a->next = std::move(b);
+		node->child = std::move(a);
+		return node;
+	}
+	ast_ptr binary (OPType code, ast_ptr a, ast_ptr b) {
+		ast_ptr node = alloc_ast_node(allocator, code);
+		ASTOptimizer::set_operands(GET_AST_PTR(node), code, std::move(a), std::move(b));
+		return node;
+	}
+
+	ast_ptr neg (ast_ptr a) {
+		if (a->op.code == OP_VALUE) return value(-a->op.value);
+		ast_ptr node = alloc_ast_node(allocator, OP_UNARY_NEGATE);
+		ASTOptimizer::set_operand(GET_AST_PTR(node), OP_UNARY_NEGATE, std::move(a));
+		return node;
+	}
+	ast_ptr add (ast_ptr a, ast_ptr b) {
+		if (is_const(GET_AST_PTR(a), 0.0f)) return b;
+		if (is_const(GET_AST_PTR(b), 0.0f)) return a;
+		return binary(OP_ADD, std::move(a), std::move(b));
+	}
+	ast_ptr sub (ast_ptr a, ast_ptr b) {
+		if (is_const(GET_AST_PTR(b), 0.0f)) return a;
+		if (is_const(GET_AST_PTR(a), 0.0f)) return neg(std::move(b));
+		return binary(OP_SUBSTRACT, std::move(a), std::move(b));
+	}
+	ast_ptr mul (ast_ptr a, ast_ptr b) {
+		// exact zeros of constant terms, so no nan-safety issue like in the optimizer
+		if (is_const(GET_AST_PTR(a), 0.0f) || is_const(GET_AST_PTR(b), 0.0f)) return value(0.0f);
+		if (is_const(GET_AST_PTR(a), 1.0f)) return b;
+		if (is_const(GET_AST_PTR(b), 1.0f)) return a;
+		return binary(OP_MULTIPLY, std::move(a), std::move(b));
+	}
+	ast_ptr div (ast_ptr a, ast_ptr b) {
+		if (is_const(GET_AST_PTR(a), 0.0f)) return value(0.0f);
+		if (is_const(GET_AST_PTR(b), 1.0f)) return a;
+		return binary(OP_DIVIDE, std::move(a), std::move(b));
+	}
+
+	bool depends (ASTNode const* node) {
+		if (node->op.code == OP_VARIABLE && node->op.sym == var)
+			return true;
+		for (auto* cur = GET_AST_PTR(node->child); cur; cur = GET_AST_PTR(cur->next)) {
+			if (depends(cur))
+				return true;
+		}
+		return false;
+	}
+
+	// min(a,b)' = (a'+b')/2 - sign(a-b) * (a'-b')/2   max(a,b)' = (a'+b')/2 + sign(a-b) * (a'-b')/2
+	ast_ptr minmax (bool is_max, ASTNode const* a, ast_ptr da, ASTNode const* b, ast_ptr db) {
+		ast_ptr half_sum  = mul(value(0.5f), add(clone(GET_AST_PTR(da)), clone(GET_AST_PTR(db))));
+		ast_ptr half_diff = mul(value(0.5f), sub(std::move(da), std::move(db)));
+
+		// sign() is 0 at ties, so the derivative there is the average of both sides instead of nan
+		ast_ptr sign = call(builtin_symbols().sign, binary(OP_SUBSTRACT, clone(a), clone(b)));
+
+		ast_ptr term = mul(std::move(sign), std::move(half_diff));
+		return is_max ? add(std::move(half_sum), std::move(term)) : sub(std::move(half_sum), std::move(term));
+	}
+
+	ast_ptr derive_call (ASTNode const* node) {
+		auto& B = builtin_symbols();
+		Symbol func = node->op.sym;
+		std::string_view name = node->op.text;
+		if (!find_builtin(node->op.sym)) {
+			failed = true;
+			last_err = prints("can't differentiate %.*s(), only std functions and user functions that can be inlined!", (int)name.size(), name.data());
+			return value(0.0f);
+		}
+		if (!depends(node))
+			return value(0.0f);
+
+		std::vector<ASTNode const*> args;
+		for (auto* cur = GET_AST_PTR(node->child); cur; cur = GET_AST_PTR(cur->next))
+			args.push_back(cur);
+
+		if ((func == B.min || func == B.max) && args.size() >= 2) {
+			// fold n arguments like min(min(a, b), c)
+			ast_ptr cur = clone(args[0]);
+			ast_ptr dcur = derive(args[0]);
+			for (size_t i=1; i<args.size(); ++i) {
+				ast_ptr next = call(func, clone(GET_AST_PTR(cur)), clone(args[i]));
+				dcur = minmax(func == B.max, GET_AST_PTR(cur), std::move(dcur), args[i], derive(args[i]));
+				cur = std::move(next);
+			}
+			return dcur;
+		}
+		if (func == B.clamp && args.size() == 3) { // min(max(x, a), b)
+			ast_ptr inner = call(B.max, clone(args[0]), clone(args[1]));
+			ast_ptr dinner = minmax(true, args[0], derive(args[0]), args[1], derive(args[1]));
+			return minmax(false, GET_AST_PTR(inner), std::move(dinner), args[2], derive(args[2]));
+		}
+		if (func == B.mod && args.size() == 2) { // a - b*floor(a/b)
+			ast_ptr fl = call(B.floor, binary(OP_DIVIDE, clone(args[0]), clone(args[1])));
+			return sub(derive(args[0]), mul(derive(args[1]), std::move(fl)));
+		}
+
+		if (args.size() != 1) {
+			failed = true;
+			last_err = prints("%.*s() takes 1 argument!", (int)name.size(), name.data());
+			return value(0.0f);
+		}
+
+		ASTNode const* u = args[0];
+		ast_ptr du = derive(u);
+		float k  = deg_mode.from_deg_x;
+		float to = deg_mode.to_deg_y;
+
+		if (func == B.sqrt) return div(std::move(du), mul(value(2.0f), clone(node)));
+		if (func == B.abs ) return mul(call(B.sign, clone(u)), std::move(du));
+		if (func == B.sign) return value(0.0f);
+		if (func == B.ln  ) return div(std::move(du), clone(u));
+
+		if (func == B.floor || func == B.ceil || func == B.round) return value(0.0f);
+
+		if (func == B.sin) return mul(mul(value(k), call(B.cos, clone(u))), std::move(du));
+		if (func == B.cos) return neg(mul(mul(value(k), call(B.sin, clone(u))), std::move(du)));
+		if (func == B.tan) return div(mul(value(k), std::move(du)), binary(OP_MULTIPLY, call(B.cos, clone(u)), call(B.cos, clone(u))));
+
+		if (func == B.asin || func == B.acos) {
+			ast_ptr d = div(mul(value(to), std::move(du)), call(B.sqrt, binary(OP_SUBSTRACT, value(1.0f), binary(OP_MULTIPLY, clone(u), clone(u)))));
+			return func == B.asin ? std::move(d) : neg(std::move(d));
+		}
+		if (func == B.atan) return div(mul(value(to), std::move(du)), binary(OP_ADD, value(1.0f), binary(OP_MULTIPLY, clone(u), clone(u))));
+
+		failed = true;
+		last_err = prints("can't differentiate %.*s()!", (int)name.size(), name.data());
+		return value(0.0f);
+	}
+
+	ast_ptr derive (ASTNode const* node) {
+		OPType code = node->op.code;
+		if (code == OP_VALUE)
+			return value(0.0f);
+		if (code == OP_VARIABLE)
+			return value(node->op.sym == var ? 1.0f : 0.0f);
+		if (code == OP_FUNCCALL)
+			return derive_call(node);
+
+		ASTNode const* a = GET_AST_PTR(node->child);
+		if (code == OP_UNARY_NEGATE)
+			return neg(derive(a));
+
+		ASTNode const* b = GET_AST_PTR(a->next);
+		switch (code) {
+			case OP_ADD       : return add(derive(a), derive(b));
+			case OP_SUBSTRACT : return sub(derive(a), derive(b));
+			case OP_MULTIPLY  : return add(mul(derive(a), clone(b)), mul(clone(a), derive(b)));
+			case OP_DIVIDE    : {
+				ast_ptr db = derive(b);
+				if (is_const(GET_AST_PTR(db), 0.0f))
+					return div(derive(a), clone(b));
+				return div(sub(mul(derive(a), clone(b)), mul(clone(a), std::move(db))), binary(OP_MULTIPLY, clone(b), clone(b)));
+			}
+			case OP_POW: {
+				bool base_var = depends(a), exp_var = depends(b);
+				if (!exp_var) { // u^c -> c * u^(c-1) * u'
+					if (!base_var) return value(0.0f);
+					ast_ptr exp = b->op.code == OP_VALUE ? value(b->op.value - 1.0f) : binary(OP_SUBSTRACT, clone(b), value(1.0f));
+					return mul(mul(clone(b), binary(OP_POW, clone(a), std::move(exp))), derive(a));
+				}
+
+				ast_ptr ln_a = a->op.code == OP_VALUE ? value(logf(a->op.value)) : call(builtin_symbols().ln, clone(a));
+				if (!base_var) // c^v -> c^v * ln(c) * v'
+					return mul(mul(clone(node), std::move(ln_a)), derive(b));
+
+				// u^v -> u^v * (v' * ln(u) + v * u' / u)
+				return mul(clone(node), add(mul(derive(b), std::move(ln_a)), div(mul(clone(b), derive(a)), clone(a))));
+			}
+			default: {
+				failed = true;
+				last_err = "can't differentiate unknown op type!";
+				return value(0.0f);
+			}
+		}
+	}
+};
+
+// derivative (order times) of the formula of a function with respect to its first argument
+// calls to user functions are inlined first, lookup is like for Inliner::inline_calls, but should not limit the size of callees
+// returns null and sets last_err if it can't be differentiated
+template <typename LOOKUP>
+inline ast_ptr derivative_ast (BlockBumpAllocator& allocator, EquationDef const& def, ASTNode const* formula, int order, DegreeMode const& deg_mode,
+		LOOKUP& lookup, std::string* last_err) {
+	if (def.args.empty()) {
+		*last_err = "can't differentiate a variable!";
+		return nullptr;
+	}
+
+	// inlined bodies may contain calls themselves (callees are never circular, so this terminates)
+	ast_ptr ast = clone_ast(allocator, formula);
+	Inliner inliner = { allocator, def };
+	while (inliner.inline_calls(GET_AST_PTR(ast), lookup) > 0)
+		;
+
+	Differentiator diff = { allocator, def.arg_syms[0], deg_mode, *last_err };
+	for (int i=0; i<order; ++i) {
+		ast = diff.derive(GET_AST_PTR(ast));
+		if (diff.failed)
+			return nullptr;
+	}
+	return ast;
+}
+
+// replace calls to derivatives of user functions (f'(a), see SymbolTable::derivative) with their derivative, with the call arguments substituted
+// since the derivative is built from the callee's formula, these calls can't remain calls
+// returns the number of replaced calls, or -1 and sets last_err if one can't be differentiated
+template <typename LOOKUP>
+inline int expand_derivatives (BlockBumpAllocator& allocator, EquationDef const& def, ASTNode* node, DegreeMode const& deg_mode,
+		LOOKUP& lookup, std::string* last_err) {
+	int count = 0;
+	for (auto* cur = GET_AST_PTR(node->child); cur; cur = GET_AST_PTR(cur->next)) {
+		int res = expand_derivatives(allocator, def, cur, deg_mode, lookup, last_err);
+		if (res < 0) return -1;
+		count += res;
+	}
+
+	Symbol base;
+	int order = node->op.code == OP_FUNCCALL ? symbols.derivative(node->op.sym, &base) : 0;
+	if (order == 0)
+		return count;
+
+	std::string_view name = symbols.name(base);
+
+	EquationDef const* callee;
+	ASTNode const* formula;
+	if (!lookup(base, node->op.argc, &callee, &formula)) {
+		*last_err = prints("can't differentiate %.*s, unknown or invalid function!", (int)name.size(), name.data());
+		return -1;
+	}
+
+	ast_ptr deriv = derivative_ast(allocator, *callee, formula, order, deg_mode, lookup, last_err);
+	if (!deriv) return -1;
+
+	Inliner inliner = { allocator, def };
+	if (inliner.captures_name(GET_AST_PTR(deriv), *callee)) {
+		*last_err = prints("can't differentiate %.*s, it uses a variable with the name of an argument here!", (int)name.size(), name.data());
+		return -1;
+	}
+
+	std::vector<ASTNode const*> args;
+	for (auto* cur = GET_AST_PTR(node->child); cur; cur = GET_AST_PTR(cur->next))
+		args.push_back(cur);
+
+	ASTOptimizer::replace(node, inliner.substitute(GET_AST_PTR(deriv), *callee, args));
+	return count + 1;
+}
+
 inline void emit_ops (ASTNode const* node, std::vector<Operation>* ops) {
 
 	for (auto* cur = GET_AST_PTR(node->child); cur; cur = GET_AST_PTR(cur->next))
@@ -78,13 +802,343 @@ inline void emit_ops (ASTNode const* node, std::vector<Operation>* ops) {
 	ops->emplace_back( node->op );
 }
 
-inline bool generate_code (ASTNode* ast, std::vector<Operation>* out_ops, std::string* last_err, bool optimize) {
+/*
+	Common subexpression elimination
+	hash-conses the AST into a DAG (identical subtrees get the same class, + and * match with their operands in either order)
+	each subexpression that is used more than once is computed once as a temp before the rest of the expression,
+	temps stay on the stack above the arguments where OP_LOAD_TEMP reads them, and are dropped at the end with OP_DROP_TEMPS
+	(in the register code temps just stay in their registers, so reusing them is free)
+*/
+struct CSE {
+	EquationDef const& def;
+
+	struct Key {
+		OPType           code;
+		uint32_t         value_bits; // OP_VALUE
+		Symbol           sym;        // OP_VARIABLE, OP_FUNCCALL
+		std::vector<int> children;   // classes of operands
+
+		bool operator== (Key const& r) const {
+			return code == r.code && value_bits == r.value_bits && sym == r.sym && children == r.children;
+		}
+	};
+	struct KeyHash {
+		size_t operator() (Key const& k) const {
+			size_t h = ((size_t)k.sym * 0x85ebca6bu) ^ ((size_t)k.code * 0x9e3779b9u) ^ k.value_bits;
+			for (int c : k.children)
+				h = h * 31 + c;
+			return h;
+		}
+	};
+	std::unordered_map<Key, int, KeyHash> class_map;
+
+	struct Class {
+		ASTNode const* node; // first node of this class, the one that gets emitted
+		int            uses = 0;
+		int            temp = -1;
+	};
+	std::vector<Class> classes;
+	std::unordered_map<ASTNode const*, int> node_class;
+
+	std::vector<int> order; // classes in post order of their first use, so temps only depend on earlier temps
+
+	int classify (ASTNode const* node) {
+		Key key = {};
+		key.code = node->op.code;
+		if (key.code == OP_VALUE)
+			memcpy(&key.value_bits, &node->op.value, sizeof(float));
+		if (key.code == OP_VARIABLE || key.code == OP_FUNCCALL)
+			key.sym = node->op.sym;
+
+		for (auto* cur = GET_AST_PTR(node->child); cur; cur = GET_AST_PTR(cur->next))
+			key.children.push_back(classify(cur));
+
+		if (key.code == OP_ADD || key.code == OP_MULTIPLY)
+			std::sort(key.children.begin(), key.children.end());
+
+		auto res = class_map.emplace(std::move(key), (int)classes.size());
+		if (res.second)
+			classes.push_back({ node });
+
+		node_class[node] = res.first->second;
+		return res.first->second;
+	}
+
+	void count_uses (ASTNode const* node) {
+		int ci = node_class[node];
+		if (classes[ci].uses++ > 0)
+			return; // reuse, its operands are only computed once
+
+		for (auto* cur = GET_AST_PTR(node->child); cur; cur = GET_AST_PTR(cur->next))
+			count_uses(cur);
+
+		order.push_back(ci);
+	}
+
+	// values and arguments are free to push, anything else (including variable lookups) is worth a temp
+	bool worth_temp (ASTNode const* node) {
+		if (node->op.code == OP_VALUE) return false;
+		if (node->op.code == OP_VARIABLE && def.find_arg(node->op.sym) >= 0) return false;
+		return true;
+	}
+
+	void emit (ASTNode const* node, std::vector<Operation>* ops) {
+		auto& c = classes[node_class[node]];
+		if (c.temp >= 0) {
+			Operation op = {};
+			op.code = OP_LOAD_TEMP;
+			op.index = c.temp;
+			ops->emplace_back(op);
+			return;
+		}
+		emit_node(node, ops);
+	}
+	void emit_node (ASTNode const* node, std::vector<Operation>* ops) {
+		for (auto* cur = GET_AST_PTR(node->child); cur; cur = GET_AST_PTR(cur->next))
+			emit(cur, ops);
+
+		ops->emplace_back( node->op );
+	}
+
+	void emit_ops (ASTNode const* root, std::vector<Operation>* ops) {
+		classify(root);
+		count_uses(root);
+
+		int temps = 0;
+		for (int ci : order) {
+			auto& c = classes[ci];
+			if (c.uses > 1 && worth_temp(c.node)) {
+				emit_node(c.node, ops); // value stays on the stack as the temp
+				c.temp = temps++;
+			}
+		}
+
+		emit(root, ops);
+
+		if (temps > 0) {
+			Operation op = {};
+			op.code = OP_DROP_TEMPS;
+			op.argc = temps;
+			ops->emplace_back(op);
+		}
+	}
+};
+
+// resolve names that don't depend on other equations
+// arguments become argument positions and std functions become function pointers
+// (other names are linked to equation indices later, since equations can be reordered or renamed)
+inline void resolve_locals (EquationDef const& def, std::vector<Operation>* ops) {
+	for (auto& op : *ops) {
+		if (op.code == OP_VARIABLE) {
+			int arg = def.find_arg(op.sym);
+			if (arg >= 0) {
+				op.code = OP_ARGUMENT;
+				op.index = arg;
+			} else {
+				op.index = -1;
+			}
+		}
+		else if (op.code == OP_FUNCCALL) {
+			if (auto* builtin = find_builtin(op.sym)) {
+				op.code = OP_BUILTIN;
+				op.builtin = builtin;
+			} else {
+				op.index = -1;
+			}
+		}
+	}
+}
+
+// translate the stack code into register code (see RegCode in execute.hpp)
+// every stack slot gets a fixed register, arguments and constants are used as operands directly instead of being pushed
+inline bool emit_regcode (EquationDef const& def, std::vector<Operation> const& ops, RegCode* code, std::string* last_err) {
+	*code = {};
+	code->argc = (int)def.args.size();
+
+	auto add_name = [&] (Symbol name) {
+		for (int i=0; i<(int)code->names.size(); ++i) {
+			if (code->names[i] == name)
+				return i;
+		}
+		code->names.push_back(name);
+		return (int)code->names.size() - 1;
+	};
+
+	// first pass: collect (deduplicated) constants and the max stack depth
+	int depth = 0, max_depth = 0;
+	for (auto& op : ops) {
+		switch (op.code) {
+			case OP_VALUE: {
+				auto it = std::find_if(code->consts.begin(), code->consts.end(),
+					[&] (float c) { return memcmp(&c, &op.value, sizeof(float)) == 0; });
+				if (it == code->consts.end())
+					code->consts.push_back(op.value);
+			} break;
+
+			case OP_FUNCCALL:
+			case OP_BUILTIN:        depth -= op.argc; break;
+			case OP_ADD:
+			case OP_SUBSTRACT:
+			case OP_MULTIPLY:
+			case OP_DIVIDE:
+			case OP_POW:            depth -= 2; break;
+			case OP_UNARY_NEGATE:   depth -= 1; break;
+			case OP_DROP_TEMPS:     depth -= op.argc + 1; break;
+		}
+		depth += 1;
+		max_depth = max(max_depth, depth);
+	}
+
+	int stack_base = code->argc + (int)code->consts.size();
+	code->reg_count = stack_base + max_depth;
+
+	if (code->reg_count > Evaluator::MAX_REGS) {
+		*last_err = "expression too large!";
+		return false;
+	}
+
+	auto const_reg = [&] (float value) {
+		for (int i=0; i<(int)code->consts.size(); ++i) {
+			if (memcmp(&code->consts[i], &value, sizeof(float)) == 0)
+				return (reg_t)(code->argc + i);
+		}
+		assert(false);
+		return (reg_t)0;
+	};
+
+	// second pass: simulate the stack, but track which register holds each stack value
+	std::vector<reg_t> stack;
+	stack.reserve(max_depth);
+
+	auto emit = [&] (RegOPType type, int dst, int a=0, int b=0) -> RegOp& {
+		RegOp op = {};
+		op.code = type;
+		op.dst = (reg_t)dst;
+		op.a   = (reg_t)a;
+		op.b   = (reg_t)b;
+		code->ops.push_back(op);
+		return code->ops.back();
+	};
+
+	// move the top argc stack values into the stack registers they were pushed to, so that they are consecutive
+	// returns the first of them, call frames and builtin args start there
+	auto materialize_args = [&] (int argc) {
+		int first = (int)stack.size() - argc;
+		for (int i=first; i<(int)stack.size(); ++i) {
+			if (stack[i] != stack_base + i)
+				emit(ROP_MOV, stack_base + i, stack[i]);
+		}
+		stack.resize(first);
+		return stack_base + first;
+	};
+
+	for (auto& op : ops) {
+		int dst = stack_base + (int)stack.size(); // register of the next stack slot
+
+		switch (op.code) {
+			case OP_VALUE: {
+				stack.push_back(const_reg(op.value));
+			} break;
+
+			case OP_ARGUMENT: {
+				stack.push_back((reg_t)op.index);
+			} break;
+
+			case OP_LOAD_TEMP: {
+				// temps are the bottom entries of the stack
+				stack.push_back(stack[op.index]);
+			} break;
+
+			case OP_DROP_TEMPS: {
+				reg_t a = stack.back();
+				stack.resize(stack.size() - 1 - op.argc);
+				stack.push_back(a);
+			} break;
+
+			case OP_VARIABLE: {
+				emit(ROP_LOAD_VAR, dst).index = add_name(op.sym);
+				stack.push_back((reg_t)dst);
+			} break;
+
+			case OP_FUNCCALL: {
+				int first = materialize_args(op.argc);
+				auto& rop = emit(ROP_CALL, first, first);
+				rop.argc = (uint8_t)op.argc;
+				rop.index = add_name(op.sym);
+				stack.push_back((reg_t)first);
+			} break;
+
+			case OP_BUILTIN: {
+				int first = materialize_args(op.argc);
+				auto& rop = emit(ROP_BUILTIN, first, first);
+				rop.argc = (uint8_t)op.argc;
+				rop.builtin = op.builtin;
+				stack.push_back((reg_t)first);
+			} break;
+
+			case OP_UNARY_NEGATE: {
+				reg_t a = stack.back(); stack.pop_back();
+				dst = stack_base + (int)stack.size();
+				emit(ROP_NEGATE, dst, a);
+				stack.push_back((reg_t)dst);
+			} break;
+
+			case OP_ADD       :
+			case OP_SUBSTRACT :
+			case OP_MULTIPLY  :
+			case OP_DIVIDE    :
+			case OP_POW       : {
+				reg_t b = stack.back(); stack.pop_back();
+				reg_t a = stack.back(); stack.pop_back();
+				dst = stack_base + (int)stack.size();
+
+				RegOPType type;
+				switch (op.code) {
+					case OP_ADD       : type = ROP_ADD      ; break;
+					case OP_SUBSTRACT : type = ROP_SUBSTRACT; break;
+					case OP_MULTIPLY  : type = ROP_MULTIPLY ; break;
+					case OP_DIVIDE    : type = ROP_DIVIDE   ; break;
+					default           : type = ROP_POW      ; break;
+				}
+				emit(type, dst, a, b);
+				stack.push_back((reg_t)dst);
+			} break;
+
+			default: {
+				*last_err = "unknown op type!";
+				return false;
+			}
+		}
+	}
+
+	if (stack.size() != 1) {
+		*last_err = "stack not empty at end of code!";
+		return false;
+	}
+
+	code->result = stack[0];
+	emit(ROP_RETURN, 0);
+
+	code->links.assign(code->names.size(), -1);
+	return true;
+}
+
+inline bool generate_code (ASTNode* ast, BlockBumpAllocator& allocator, EquationDef const& def, std::vector<Operation>* out_ops, RegCode* out_code, std::string* last_err, bool optimize) {
 	out_ops->clear();
 
-	if (optimize)
+	if (optimize) {
 		constant_folding(ast);
-	
-	emit_ops(ast, out_ops);
 
-	return true;
+		ASTOptimizer opt = { allocator };
+		opt.optimize(ast);
+
+		CSE cse = { def };
+		cse.emit_ops(ast, out_ops);
+	} else {
+		emit_ops(ast, out_ops);
+	}
+
+	resolve_locals(def, out_ops);
+
+	return emit_regcode(def, *out_ops, out_code, last_err);
 }
\ No newline at end of file
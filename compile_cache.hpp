@@ -0,0 +1,124 @@
+#pragma once
+#include "common.hpp"
+#include "codegen.hpp"
+#include <list>
+#include <mutex>
+
+/*
+	Cache of the code generated for the formulas of equations (see Equation::compile)
+
+	Keyed by everything generate_code looks at: the ast of the formula serialized in pre order (op codes, constants, symbols, argument counts),
+	with arguments replaced by their position, the number of arguments and the optimize setting.
+	So equations with the same formula share the code regardless of their name, argument names or formatting,
+	and retyping earlier text or toggling optimize back and forth finds it again.
+
+	Entries are immutable once inserted and shared with whoever looked them up, the LRU pool is limited to max_entries.
+	The cached ops get their text from the symbol table, so they don't point into the text of the equation they were generated for.
+*/
+struct CompiledFormula {
+	bool                   valid;
+	std::string            err;
+	std::vector<Operation> ops;
+	RegCode                code; // not linked
+};
+
+struct CompileCache {
+	size_t max_entries = 4096;
+
+	typedef std::vector<uint32_t> Key;
+
+	struct KeyHash {
+		size_t operator() (Key const& k) const {
+			size_t h = k.size();
+			for (uint32_t v : k)
+				h = (h ^ v) * 0x100000001b3ull;
+			return h;
+		}
+	};
+
+	struct Entry {
+		Key                                    key;
+		std::shared_ptr<CompiledFormula const> compiled;
+	};
+
+	std::mutex mutex; // equations can be compiled on multiple threads
+	std::list<Entry> lru; // most recently used first
+	std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> map;
+
+	int hits = 0, misses = 0;
+
+	enum : uint32_t { KEY_ARGUMENT = 0x80000000u };
+
+	static void build_key (ASTNode const* node, EquationDef const& def, Key* key) {
+		uint32_t children = 0;
+		for (auto* cur = GET_AST_PTR(node->child); cur; cur = GET_AST_PTR(cur->next))
+			children++;
+
+		key->push_back((uint32_t)node->op.code | children << 8);
+
+		if (node->op.code == OP_VALUE) {
+			uint32_t bits;
+			memcpy(&bits, &node->op.value, sizeof(float));
+			key->push_back(bits);
+		}
+		else if (node->op.code == OP_VARIABLE) {
+			int arg = def.find_arg(node->op.sym);
+			key->push_back(arg >= 0 ? KEY_ARGUMENT | (uint32_t)arg : node->op.sym);
+		}
+		else if (node->op.code == OP_FUNCCALL) {
+			key->push_back(node->op.sym);
+			key->push_back((uint32_t)node->op.argc);
+		}
+
+		for (auto* cur = GET_AST_PTR(node->child); cur; cur = GET_AST_PTR(cur->next))
+			build_key(cur, def, key);
+	}
+
+	// code of a formula, generated on a copy in scratch if it is not cached yet (so the formula itself is never modified)
+	std::shared_ptr<CompiledFormula const> compile (ASTNode const* formula, EquationDef const& def, bool optimize, BlockBumpAllocator& scratch) {
+		ZoneScoped;
+
+		Key key;
+		key.push_back((uint32_t)def.args.size() << 1 | (uint32_t)optimize);
+		build_key(formula, def, &key);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			auto it = map.find(key);
+			if (it != map.end()) {
+				lru.splice(lru.begin(), lru, it->second); // mark as most recently used
+				hits++;
+				return it->second->compiled;
+			}
+			misses++;
+		}
+
+		auto compiled = std::make_shared<CompiledFormula>();
+
+		ast_ptr ast = clone_ast(scratch, formula);
+		compiled->valid = generate_code(GET_AST_PTR(ast), scratch, def, &compiled->ops, &compiled->code, &compiled->err, optimize);
+
+		for (auto& op : compiled->ops)
+			op.text = op.sym != NO_SYMBOL ? symbols.name(op.sym) : std::string_view();
+
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = map.find(key);
+		if (it != map.end()) // compiled on another thread meanwhile
+			return it->second->compiled;
+
+		while (!lru.empty() && lru.size() >= max_entries) {
+			map.erase(lru.back().key);
+			lru.pop_back();
+		}
+
+		lru.push_front({ key, compiled });
+		map.emplace(std::move(key), lru.begin());
+		return compiled;
+	}
+
+	void clear () {
+		std::lock_guard<std::mutex> lock(mutex);
+		lru.clear();
+		map.clear();
+	}
+};
@@ -1,7 +1,12 @@
+#pragma once
 #include "common.hpp"
 #include "parse.hpp"
 #include "codegen.hpp"
+#include "compile_cache.hpp"
 #include "execute.hpp"
+#include "jit.hpp"
+#include "thread_pool.hpp"
+#include <chrono>
 
 struct Equation {
 	std::string text;
@@ -16,55 +21,121 @@ struct Equation {
 	std::string last_err = "";
 
 	// pointers into std::string text seem to break? small string optimization?
-	std::unique_ptr<char[]> string_buf;
+	std::shared_ptr<char[]> string_buf; // copy of text that tokens point into
+	std::shared_ptr<char[]> parsed_buf; // copy of text that def and the asts point into, older than string_buf if edits only changed whitespace
+	std::vector<Token>      tokens;     // of string_buf, kept for edit, empty if text could not be tokenized
 
 	EquationDef            def;
 
-	std::vector<Operation> ops;
+	std::unique_ptr<BlockBumpAllocator> allocator;      // owns the nodes of formula, reset by every parse
+	std::unique_ptr<BlockBumpAllocator> spec_allocator; // owns the nodes of specialized and slope, reset by every compile
+	ast_ptr                formula     = nullptr; // ast of the rhs, kept to respecialize it and to inline it into callers
+	ast_ptr                specialized = nullptr; // formula with calls inlined and variables substituted (see Equations::specialize), null if there were none
+
+	std::vector<Operation> ops;  // stack code, only kept for debugging and to benchmark the old interpreter
+	RegCode                code; // register code that actually gets executed
+
+	std::shared_ptr<JitKernel> jit; // native version of code, if it could be compiled (shared with the snapshots of AsyncSampler)
+
+	RegCode                slope; // derivative of the function, built on demand by Equations::slope_code
+	int                    slope_stamp = -1; // code_stamp that slope was built for
+
+	int                    version = 0; // incremented on every edit, tells Equations::update_code what to recompile
+	int                    code_stamp = 0; // new whenever update_code rebuilds the code, which includes edits of anything it depends on (keys the sample cache)
 	
 	inline static bool optimize = true;
+	inline static bool use_jit = true;
+
+	inline static CompileCache compile_cache;
 
-	Equation (std::string_view text = "", float4 const& col = float4(1,1,1,1)): text{text}, col{col} {
-		parse();
+	// parse_now = false leaves parsing to the caller (see Equations::add_equations)
+	Equation (std::string_view text = "", float4 const& col = float4(1,1,1,1), bool parse_now = true): text{text}, col{col} {
+		if (parse_now)
+			parse();
 	}
 
+	// parse text from scratch
 	void parse () {
 		ZoneScoped;
+		tokens.clear();
+		update(true);
+	}
+	// parse text after it was edited, only tokenizing the edited part again
+	// skips parsing and codegen if the tokens did not change, so the equation and everything depending on it is left as it is
+	void edit () {
+		ZoneScoped;
+		update(false);
+	}
+
+	void update (bool force) {
+		auto old_buf = std::move(string_buf);
+		string_buf = std::shared_ptr<char[]>(new char[text.size()+1]);
+		memcpy(string_buf.get(), text.c_str(), text.size()+1);
+
+		std::string err;
+		bool changed = true;
+		bool tokenized = tokens.empty() ?
+			tokenize(string_buf.get(), &tokens, &err) :
+			retokenize(old_buf.get(), string_buf.get(), &tokens, &changed, &err);
 
+		if (!tokenized)
+			tokens.clear(); // start over next time
+		else if (!changed && !force)
+			return; // the same tokens parse into the same ast, parsed_buf still holds the text that it points into
+
+		version++;
 		valid = false;
 
-		last_err = "";
+		last_err = err;
 
 		def.is_variable = false;
 		def.name = "";
 		def.args.clear();
-		def.arg_map.clear();
-
-		string_buf = std::unique_ptr<char[]>(new char[text.size()+1]);
-		memcpy(string_buf.get(), text.c_str(), text.size()+1);
+		def.sym = NO_SYMBOL;
+		def.arg_syms.clear();
 
-		std::vector<Token> tokens;
-		tokens.reserve(64);
-
-		if (!tokenize(string_buf.get(), &tokens, &last_err)) {
+		if (!tokenized) {
 			return;
 		}
 
-		BlockBumpAllocator allocator;
+		formula = nullptr;
+		specialized = nullptr;
+		if (!allocator) allocator = std::make_unique<BlockBumpAllocator>();
+		allocator->reset();
+
+		parsed_buf = string_buf;
+
 		Parser parser = {
 			tokens.data(),
 			last_err,
-			allocator
+			*allocator
 		};
 		
-		ast_ptr formula;
 		if (!parser.parse_equation(&def, &formula)) {
 			return;
 		}
 
-		def.create_arg_map();
+		// fold constants in the formula itself, so that a = -2 is a value (see show_slider)
+		// the rest of the optimizer only works on copies (see CompileCache::compile)
+		if (optimize)
+			constant_folding(GET_AST_PTR(formula));
 
-		valid = generate_code(GET_AST_PTR(formula), &ops, &last_err, optimize);
+		valid = compile();
+	}
+
+	// generate code for the formula alone, calls stay calls
+	// equations with the same formula share the code from the compile cache
+	bool compile () {
+		specialized = nullptr;
+		if (!spec_allocator) spec_allocator = std::make_unique<BlockBumpAllocator>();
+		spec_allocator->reset();
+
+		auto compiled = compile_cache.compile(GET_AST_PTR(formula), def, optimize, *spec_allocator);
+		ops  = compiled->ops;
+		code = compiled->code;
+		if (!compiled->valid)
+			last_err = compiled->err;
+		return compiled->valid;
 	}
 
 	std::string dbg_eval () {
@@ -88,6 +159,7 @@ struct Equation {
 			return "execute error! "+ last_err;
 
 		str.append("\nops: "+ result);
+		str.append("\nregcode: "+ dbg_regcode(code));
 
 		return str;
 	}
@@ -120,11 +192,57 @@ struct Equations {
 		return colors[next_std_col++ % colors.size()];
 	}
 
+	// set whenever equations are added, removed or reordered, makes update_code rebuild the whole program
+	// (edits are detected through Equation::version)
+	bool changed = true;
+
+	// everything needed to evaluate the equations, persists across frames
+	struct Program {
+		Evaluator        eval;   // degree mode, values of variables and code of functions, indexed by equation
+		std::vector<int> sorted; // valid equations in dependency order
+		int              version = 0; // incremented whenever update_code changes anything
+	};
+	Program program;
+
 	void add_equation (std::string_view text) {
 		equations.emplace_back(text, float4(get_std_col(), 1));
+		changed = true;
+	}
+
+	// for parsing and jitting many equations at once
+	// separate from the pool of the AsyncSampler, which keeps sampling on its background thread while update_code runs on the main thread
+	// (WorkStealingPool::run can't be called from two threads at once, sharing it would make edits wait for sampling)
+	// the sampler already has a thread per core, so this one only gets half the cores, at most MAX_THREADS, for the short bursts of compiling
+	static constexpr int MAX_THREADS = 4;
+	WorkStealingPool pool;
+
+	// add many equations at once (like a loaded workspace), which get tokenized, parsed and compiled in parallel
+	// the name map and dependency graph are then built once for all of them by the next update_code
+	void add_equations (std::vector<std::string> const& texts) {
+		ZoneScoped;
+
+		size_t first = equations.size();
+		equations.reserve(first + texts.size());
+		for (auto& text : texts)
+			equations.emplace_back(text, float4(get_std_col(), 1), false);
+
+		parse_equations(first);
+		changed = true;
+	}
+
+	// parse the equations from first on in parallel
+	// each equation has its own arenas, and the symbol table and compile cache are locked, so equations can parse independently
+	void parse_equations (size_t first=0) {
+		ZoneScoped;
+
+		pool.run((int)(equations.size() - first), [&] (int i, int thread) {
+			equations[first + i].parse();
+		});
 	}
 
 	Equations () {
+		pool.start(clamp((int)std::thread::hardware_concurrency() / 2, 1, MAX_THREADS));
+
 		int coli = 0;
 
 		//add_equation("3*x");
@@ -184,82 +302,507 @@ struct Equations {
 		//add_equation("a-b/c-d");
 	}
 	
-	std::unordered_map<std::string_view, int> name_map;
+	static constexpr int NAME_UNKNOWN   = -1;
+	static constexpr int NAME_AMBIGUOUS = -2;
+
+	// equation index of each Symbol, or NAME_UNKNOWN / NAME_AMBIGUOUS (symbols interned after this was built are unknown)
+	std::vector<int> name_map;
 
 	void create_name_map () {
-		name_map.clear();
+		name_map.assign(symbols.count(), NAME_UNKNOWN);
 
 		for (int eq_i=0; eq_i<(int)equations.size(); ++eq_i) {
 			auto& eq = equations[eq_i];
 
-			if (eq.valid && !eq.def.name.empty()) {
-				auto res = name_map.emplace(eq.def.name, eq_i);
-				if (!res.second) { // dupliacte name, did not insert
-					// set value of name_map (the equation index coresponding to the name key) to -1
-					// to signal that the name exists, but is ambiguous
-					res.first->second = -1;
-				}
+			if (eq.valid && eq.def.sym != NO_SYMBOL) {
+				int& entry = name_map[eq.def.sym];
+				// a duplicate name exists, but is ambiguous
+				entry = entry == NAME_UNKNOWN ? eq_i : NAME_AMBIGUOUS;
 			}
+		}
+	}
+	int find_name (Symbol sym) const {
+		return sym < name_map.size() ? name_map[sym] : NAME_UNKNOWN;
+	}
+
+	// link names to equation indices, unresolved or ambiguous names get -1
+	void link_code (Equation& eq) {
+		for (int i=0; i<(int)eq.code.names.size(); ++i)
+			eq.code.links[i] = max(find_name(eq.code.names[i]), -1);
 
-			eq.exec_valid = true;
+		// the stack code is only run by benchmark_vms, but keep it linked as well
+		for (auto& op : eq.ops) {
+			if (op.code == OP_VARIABLE || op.code == OP_FUNCCALL)
+				op.index = max(find_name(op.sym), -1);
 		}
 	}
 
+	// Dependency graph between the equations (indices), kept up to date by update_code
+	// edges come from the names the formula of an equation references, so they don't change when it gets specialized
+	struct GraphNode {
+		std::vector<int> deps;  // equations this one references
+		std::vector<int> users; // equations that reference this one
+		
+		int         version = -1;        // version of the equation that the program was built from
+		Symbol      name = NO_SYMBOL;    // name the equation had then, other equations link to it by name
+
+		bool        circular = false; // part of a dependency cycle, set by dependency_sort
+	};
+	std::vector<GraphNode> graph;
+
+	int last_code_stamp = 0;
+
+	// recompile an equation (its formula alone) and replace its edges in the graph
+	// returns true if the edges changed
+	bool compile_node (int eq_i) {
+		auto& eq = equations[eq_i];
+		auto& node = graph[eq_i];
+
+		std::vector<int> old_deps = std::move(node.deps);
+		node.deps.clear();
+		for (int dep : old_deps) {
+			auto& users = graph[dep].users;
+			users.erase(std::find(users.begin(), users.end(), eq_i));
+		}
+
+		node.version = eq.version;
+		node.name = eq.valid ? eq.def.sym : NO_SYMBOL;
 
-	void recurse_dependency_sort (int eq_i, std::vector<int>& visited, std::vector<int>& sorted) {
+		eq.code_stamp = ++last_code_stamp;
+
+		eq.jit = nullptr;
+
+		if (!eq.valid)
+			return !old_deps.empty(); // pretend invalid equations don't exist
+
+		// the code of the formula alone is still there from parse, unless specialize replaced it
+		if (eq.specialized)
+			eq.compile();
+		else
+			eq.spec_allocator->reset(); // no longer needed for the slope
+
+		eq.exec_valid = true;
+		eq.last_err = "";
+
+		link_code(eq);
+
+		// names in the register code are already deduplicated
+		for (int i=0; i<(int)eq.code.names.size(); ++i) {
+			// derivatives f'(x) depend on f (these are never linked, see specialize)
+			Symbol name;
+			symbols.derivative(eq.code.names[i], &name);
+
+			int dep_eq_i = find_name(name);
+			if (dep_eq_i >= 0) {
+				if (std::find(node.deps.begin(), node.deps.end(), dep_eq_i) == node.deps.end()) { // f and f' are both names
+					node.deps.push_back(dep_eq_i);
+					graph[dep_eq_i].users.push_back(eq_i);
+				}
+			}
+			else if (dep_eq_i == NAME_AMBIGUOUS) {
+				// name exists, but is ambiguous dupliacte ref
+				eq.exec_valid = false;
+				eq.last_err = "reference to ambiguous function/variable name";
+			}
+			// else var or func not found, actually a missing dependency (arguments are already resolved)
+			// leave potential error reporting to later function evaluation
+		}
+
+		return node.deps != old_deps;
+	}
+
+	void recurse_dependency_sort (int eq_i, std::vector<int>& visited, std::vector<int>& stack, std::vector<int>& sorted) {
 
 		Equation& eq = equations[eq_i];
 		if (!eq.valid)
 			return; // pretend invalid equations don't exist
 
-		if (visited[eq_i] > 0) {
-			//if (visited[eq_i] >= 2 && eq.exec_valid) {
-			//	// circular dependency detected!
-			//	eq.exec_valid = false;
-			//	eq.last_err = "circular reference!";
-			//}
-			return; // equation already visited, skip
+		if (visited[eq_i] == 2) {
+			// circular dependency detected, everything on the stack from here on is part of the cycle
+			for (auto it = stack.rbegin(); it != stack.rend(); ++it) {
+				graph[*it].circular = true;
+				if (*it == eq_i) break;
+			}
+			return;
 		}
+		if (visited[eq_i] > 0)
+			return; // equation already visited, skip
+		
 		visited[eq_i] = 2; // set to <currently visiting>
+		stack.push_back(eq_i);
 
-		for (auto& op : eq.ops) {
-			if (op.code == OP_VARIABLE || op.code == OP_FUNCCALL) {
-				auto it = name_map.find(op.text);
-				if (it == name_map.end()) {
-					// var or func not found, could be function argument or actually a missing dependency
-					// leave potential error reporting to later function evaluation
-				} else {
-					// recurse into equation dependecies
-					int dep_eq_i = it->second;
-					if (dep_eq_i <= -1) {
-						// name exists, but is ambiguous dupliacte ref
-						eq.exec_valid = false;
-						eq.last_err = "reference to ambiguous function/variable name";
-					} else {
-						recurse_dependency_sort(dep_eq_i, visited, sorted);
-					}
-				}
-			}
-		}
+		// recurse into equation dependecies
+		for (int dep_eq_i : graph[eq_i].deps)
+			recurse_dependency_sort(dep_eq_i, visited, stack, sorted);
 
+		stack.pop_back();
 		visited[eq_i] = 1; // set to <visited>
 
 		// add to sorted list after recursive calls have inserted all our dependencies first
 		sorted.push_back(eq_i);
 	}
 
+	// sort the graph such that dependencies are always first, this only needs to be redone when its edges change
 	void dependency_sort (std::vector<int>* sorted) {
-
-		create_name_map();
-
 		// per equation, 0 = not visited   1 = visited   2 = currently visiting
 		std::vector<int> visited (equations.size(), 0);
+		std::vector<int> stack;
+
+		for (auto& node : graph)
+			node.circular = false;
 
 		for (int eq_i=0; eq_i<(int)equations.size(); ++eq_i) {
-			recurse_dependency_sort(eq_i, visited, *sorted);
+			recurse_dependency_sort(eq_i, visited, stack, *sorted);
+		}
+	}
+
+	// rebuild the parts of the program affected by edits, otherwise there is nothing to do per frame
+	// edited equations (whose version changed) and everything downstream of them get recompiled, specialized,
+	// evaluated (variables) and jitted, adding, removing or reordering equations or changing the degree mode rebuilds everything
+	void update_code (DegreeMode const& deg_mode) {
+		ZoneScoped;
+
+		int count = (int)equations.size();
+
+		bool full = changed || (int)graph.size() != count || memcmp(&deg_mode, &program.eval.deg_mode, sizeof(DegreeMode)) != 0;
+
+		std::vector<int> edited;
+		for (int eq_i=0; !full && eq_i<count; ++eq_i) {
+			auto& eq = equations[eq_i];
+			if (graph[eq_i].version == eq.version)
+				continue;
+
+			edited.push_back(eq_i);
+
+			// a new name changes what other equations link to, so just redo everything
+			if (graph[eq_i].name != (eq.valid ? eq.def.sym : NO_SYMBOL))
+				full = true;
+		}
+
+		if (!full && edited.empty())
+			return;
+		changed = false;
+		program.version++;
+
+		// equations can have been renamed, and new names interned since
+		create_name_map();
+
+		std::vector<bool> affected (count, full);
+
+		if (full) {
+			graph.assign(count, {});
+
+			program.eval.deg_mode = deg_mode;
+			program.eval.var_values.assign(count, {});
+			program.eval.functions .assign(count, {});
+		} else {
+			// everything downstream of the edited equations
+			std::vector<int> queue = edited;
+			for (int eq_i : edited)
+				affected[eq_i] = true;
+
+			while (!queue.empty()) {
+				int eq_i = queue.back();
+				queue.pop_back();
+
+				for (int user : graph[eq_i].users) {
+					if (!affected[user]) {
+						affected[user] = true;
+						queue.push_back(user);
+					}
+				}
+			}
+		}
+
+		// specialized code can refer to names in the text of edited or removed equations, so start over from the code of each formula alone
+		bool edges_changed = full;
+		for (int eq_i=0; eq_i<count; ++eq_i) {
+			if (affected[eq_i]) {
+				edges_changed = compile_node(eq_i) || edges_changed;
+				program.eval.var_values[eq_i] = {};
+				program.eval.functions [eq_i] = {};
+			}
+		}
+
+		// a cycle can only appear or disappear through changed edges, and all of its equations are downstream of those
+		if (edges_changed) {
+			program.sorted.clear();
+			dependency_sort(&program.sorted);
+		}
+
+		std::vector<int> order;
+		for (int eq_i : program.sorted) {
+			if (!affected[eq_i]) continue;
+
+			if (graph[eq_i].circular) {
+				equations[eq_i].exec_valid = false;
+				equations[eq_i].last_err = "circular reference!";
+			}
+			order.push_back(eq_i);
+		}
+
+		specialize(order);
+
+		// kernels only read the program, so they compile in parallel
+		std::vector<int> jit_order;
+		for (int eq_i : order) {
+			auto& eq = equations[eq_i];
+			if (!eq.def.is_variable && eq.exec_valid)
+				jit_order.push_back(eq_i);
+		}
+		pool.run((int)jit_order.size(), [&] (int i, int thread) {
+			auto& eq = equations[jit_order[i]];
+
+			// falls back to the interpreter if this fails, which then reports any errors
+			// always a new kernel, since a snapshot might still be running the old one
+			auto jit = std::make_shared<JitKernel>();
+			eq.jit = jit->compile(eq.code, program.eval) && jit->bind(program.eval) ? std::move(jit) : nullptr;
+		});
+	}
+
+	static constexpr int INLINE_MAX_NODES = 64;
+
+	// go through the equations in dependency order, evaluating variables into program.eval and adding functions to it
+	// calls to derivatives f'(x) are always replaced with the derivative of the formula of f, since there is no code to call for them
+	// with optimize, the code of each equation is also specialized to the current state of all the others:
+	// - calls to small functions are inlined, which saves the call overhead per sample and lets the optimizer and CSE work across calls
+	//   callees come first, so they are already specialized themselves and call chains get flattened
+	// - the values of variables are substituted into the equations using them, so they get constant folded
+	// (not done without optimize, since arguments that a callee uses more than once are only merged by CSE)
+	void specialize (std::vector<int> const& order) {
+		ZoneScoped;
+
+		auto& eval = program.eval;
+
+		// equations that are not in order are still specialized from last time
+		std::vector<bool> done (equations.size(), true);
+		for (int eq_i : order)
+			done[eq_i] = false;
+
+		// callees in a circular dependency are not done yet when their callers are specialized
+		auto lookup_callee = [&] (Symbol name, int argc, EquationDef const** def, ASTNode const** formula) {
+			return find_callee(name, argc, done, def, formula);
+		};
+		auto lookup_func = [&] (Symbol name, int argc, EquationDef const** def, ASTNode const** formula) {
+			return find_callee(name, argc, done, def, formula) && count_ast_nodes(*formula) <= INLINE_MAX_NODES;
+		};
+		auto lookup_var = [&] (Symbol name, float* value) {
+			int var_i = find_name(name);
+			if (var_i < 0)
+				return false;
+
+			// only set for variables that are done and could be evaluated
+			auto& var = eval.var_values[var_i];
+			*value = var.value;
+			return var.valid;
+		};
+
+		for (int eq_i : order) {
+			auto& eq = equations[eq_i];
+
+			if (eq.exec_valid) {
+				ast_ptr ast = clone_ast(*eq.spec_allocator, GET_AST_PTR(eq.formula));
+
+				int changes = expand_derivatives(*eq.spec_allocator, eq.def, GET_AST_PTR(ast), eval.deg_mode, lookup_callee, &eq.last_err);
+				int derivatives = changes;
+				if (changes < 0) {
+					eq.exec_valid = false;
+				}
+				else if (Equation::optimize) {
+					Inliner inliner = { *eq.spec_allocator, eq.def };
+					changes += inliner.inline_calls(GET_AST_PTR(ast), lookup_func);
+					changes += substitute_variables(GET_AST_PTR(ast), eq.def, lookup_var);
+				}
+
+				if (changes > 0) {
+					std::vector<Operation> ops;
+					RegCode code;
+					std::string err;
+					if (generate_code(GET_AST_PTR(ast), *eq.spec_allocator, eq.def, &ops, &code, &err, Equation::optimize)) {
+						eq.ops         = std::move(ops);
+						eq.code        = std::move(code);
+						eq.specialized = std::move(ast);
+						link_code(eq);
+					}
+					// keep the code of the formula alone if this fails (too large for the register file), unless it needs the derivatives
+					else if (derivatives > 0) {
+						eq.exec_valid = false;
+						eq.last_err = err;
+					}
+				}
+			}
+
+			if (eq.def.is_variable) {
+				float value;
+				if (eq.exec_valid)
+					eq.exec_valid = eval.execute(eq.code, 0, &value, &eq.last_err);
+				if (eq.exec_valid)
+					eval.var_values[eq_i] = { value, true };
+			} else {
+				// ambiguous names are never linked to, so no need to check for them here
+				if (eq.exec_valid)
+					eval.functions[eq_i] = { &eq.def, &eq.code };
+			}
+
+			done[eq_i] = true;
 		}
 	}
 
+	// function that can be inlined or differentiated, done says which equations are specialized already
+	bool find_callee (Symbol name, int argc, std::vector<bool> const& done, EquationDef const** def, ASTNode const** formula) {
+		int callee_i = find_name(name);
+		if (callee_i < 0)
+			return false;
+
+		auto& callee = equations[callee_i];
+		if (!done[callee_i] || !callee.exec_valid || callee.def.is_variable || (int)callee.def.args.size() != argc)
+			return false;
+
+		*def = &callee.def;
+		*formula = callee.specialized ? GET_AST_PTR(callee.specialized) : GET_AST_PTR(callee.formula);
+		return true;
+	}
+
+	// code of the derivative of a function (the same that f'(x) inlines), linked to the current program
+	// gives exact slopes at single points without evaluating neighbouring samples, null if it can't be differentiated
+	// built on demand and kept until the code of the function changes
+	RegCode* slope_code (int eq_i) {
+		auto& eq = equations[eq_i];
+		if (!eq.exec_valid || eq.def.is_variable || eq.def.args.empty())
+			return nullptr;
+
+		if (eq.slope_stamp != eq.code_stamp) {
+			ZoneScoped;
+
+			eq.slope_stamp = eq.code_stamp;
+			eq.slope = {};
+
+			// everything is specialized outside of update_code
+			std::vector<bool> done (equations.size(), true);
+			auto lookup_callee = [&] (Symbol name, int argc, EquationDef const** def, ASTNode const** formula) {
+				return find_callee(name, argc, done, def, formula);
+			};
+
+			ASTNode const* formula = eq.specialized ? GET_AST_PTR(eq.specialized) : GET_AST_PTR(eq.formula);
+
+			std::string err;
+			std::vector<Operation> ops;
+			ast_ptr deriv = derivative_ast(*eq.spec_allocator, eq.def, formula, 1, program.eval.deg_mode, lookup_callee, &err);
+			if (!deriv || !generate_code(GET_AST_PTR(deriv), *eq.spec_allocator, eq.def, &ops, &eq.slope, &err, Equation::optimize)) {
+				eq.slope = {};
+				return nullptr;
+			}
+
+			for (int i=0; i<(int)eq.slope.names.size(); ++i)
+				eq.slope.links[i] = max(find_name(eq.slope.names[i]), -1);
+		}
+
+		return eq.slope.ops.empty() ? nullptr : &eq.slope;
+	}
+
+	// compare the old stack interpreter against the register vm (scalar and batch) on the current equations
+	struct VMBenchmark {
+		std::string text;
+		std::string err;
+		float stack_ns, reg_ns, batch_ns, jit_ns; // per sample, jit_ns < 0 if it could not be compiled
+	};
+	std::vector<VMBenchmark> vm_benchmark;
+
+	void benchmark_vms () {
+		ZoneScoped;
+
+		vm_benchmark.clear();
+
+		// run the current program, with the stack interpreter set up the same way
+		auto& eval = program.eval;
+
+		StackEvaluator stack_eval;
+		stack_eval.deg_mode = eval.deg_mode;
+		stack_eval.var_values.assign(equations.size(), {});
+		stack_eval.functions .assign(equations.size(), {});
+
+		for (int eq_i : program.sorted) {
+			auto& eq = equations[eq_i];
+			if (!eq.exec_valid) continue;
+
+			if (eq.def.is_variable) {
+				stack_eval.var_values[eq_i] = { eval.var_values[eq_i].value, eval.var_values[eq_i].valid };
+			} else {
+				stack_eval.functions[eq_i] = { &eq.def, &eq.ops };
+			}
+		}
+
+		constexpr int N = 1 << 16;
+		std::vector<float> xs (N), ys (N);
+		for (int i=0; i<N; ++i)
+			xs[i] = -10.0f + 20.0f * (float)i / N;
+
+		auto time_ns = [] (auto func) {
+			auto t0 = std::chrono::high_resolution_clock::now();
+			const char* err = func();
+			auto t1 = std::chrono::high_resolution_clock::now();
+			return std::make_pair(err, (float)std::chrono::duration<double, std::nano>(t1 - t0).count() / N);
+		};
+
+		for (int eq_i : program.sorted) {
+			auto& eq = equations[eq_i];
+			if (!eq.exec_valid || eq.def.is_variable || eq.def.args.size() > 1) continue;
+
+			VMBenchmark res = {};
+			res.text = eq.text;
+
+			auto stack = time_ns([&] () -> const char* {
+				for (int i=0; i<N; ++i) {
+					auto err = stack_eval.execute(eq.def, eq.ops, xs[i], &ys[i]);
+					if (err) return err;
+				}
+				return nullptr;
+			});
+			auto reg = time_ns([&] () -> const char* {
+				for (int i=0; i<N; ++i) {
+					auto err = eval.execute(eq.code, xs[i], &ys[i]);
+					if (err) return err;
+				}
+				return nullptr;
+			});
+			auto batch = time_ns([&] () {
+				return eval.execute_batch(eq.code, xs.data(), ys.data(), N);
+			});
+
+			res.jit_ns = -1;
+			if (eq.jit) {
+				res.jit_ns = time_ns([&] () -> const char* {
+					eq.jit->run(xs.data(), ys.data(), N);
+					return nullptr;
+				}).second;
+			}
+
+			res.stack_ns = stack.second;
+			res.reg_ns   = reg.second;
+			res.batch_ns = batch.second;
+			res.err = stack.first ? stack.first : reg.first ? reg.first : batch.first ? batch.first : "";
+
+			vm_benchmark.push_back(std::move(res));
+		}
+	}
+
+	void imgui_benchmark_vms () {
+		if (!ImGui::TreeNode("VM Benchmark")) return;
+
+		if (ImGui::Button("Run"))
+			benchmark_vms();
+
+		ImGui::Text("ns/sample     stack   register      batch        jit");
+		for (auto& res : vm_benchmark) {
+			if (!res.err.empty())
+				ImGui::TextColored(ImVec4(1,0,0,1), "%s: %s", res.text.c_str(), res.err.c_str());
+			else
+				ImGui::Text("%-12s %7.2f    %7.2f    %7.2f    %7.2f", res.text.c_str(), res.stack_ns, res.reg_ns, res.batch_ns, res.jit_ns);
+		}
+
+		ImGui::TreePop();
+	}
+
 	void drag_drop_equations (int src, int dst) {
 		assert(src >= 0 && src < (int)equations.size());
 		assert(dst >= 0 && dst < (int)equations.size());
@@ -281,6 +824,7 @@ struct Equations {
 		}
 
 		equations[dst] = std::move(tmp);
+		changed = true;
 	}
 
 	void imgui () {
@@ -308,7 +852,7 @@ struct Equations {
 
 			ImGui::SameLine();
 			if (ImGui::InputText("##text", &eq.text))
-				eq.parse();
+				eq.edit();
 
 			if (ImGui::BeginDragDropTarget()) {
 				if (auto* payload = ImGui::AcceptDragDropPayload("DND_EQUATION")) {
@@ -339,21 +883,24 @@ struct Equations {
 			ImGui::SameLine();
 			bool del = ImGui::Button("X");
 
-			// TODO: awkward to be looking directly at the generated code here?
-			// but also don't really want to look at the text or ast either (let's not reparse just because the slider value has changed)
-			bool show_slider = eq.valid && eq.def.is_variable && eq.ops.size() == 1 && eq.ops[0].code == OP_VALUE;
+			// look at the formula, the code of a variable like b = 2*m is constant too once m is substituted
+			// (let's not reparse just because the slider value has changed)
+			bool show_slider = eq.valid && eq.def.is_variable && eq.formula->op.code == OP_VALUE;
 
 			if (show_slider) {
 				ImGui::SameLine();
 				if (ImGui::TreeNodeEx("##submenu", ImGuiTreeNodeFlags_DefaultOpen)) {
 					
-					float value = eq.ops[0].value;
+					float value = eq.formula->op.value;
 					if (ImGui::DragFloat("##slider", &value, 0.01f)) {
 						// update text and code, new text _should_ parse to new code
 						// This is not ideal though, since the user might expect the text to keep his formatting
 						// 'correct' solution to avoid this would be to let user select a slider which then makes the text input window disappear and overrides the code
 						eq.text = eq.def.name + prints(" = %g", value);
 						eq.ops[0].value = value;
+						eq.code.consts[0] = value;
+						eq.formula->op.value = value;
+						eq.version++;
 					}
 
 					ImGui::TreePop();
@@ -364,6 +911,7 @@ struct Equations {
 
 			if (del) {
 				it = equations.erase(it);
+				changed = true;
 			} else {
 				++it;
 			}
@@ -374,12 +922,17 @@ struct Equations {
 			add_equation("");
 		}
 
+		ImGui::Checkbox("jit", &Equation::use_jit);
+		ImGui::SameLine();
 		bool reparse = ImGui::Checkbox("codegen optimize", &Equation::optimize);
 		
-		if (reparse) {
-			for (auto& eq : equations)
-			eq.parse();
-		}
+		if (reparse)
+			parse_equations();
+
+		auto& cache = Equation::compile_cache;
+		ImGui::Text("compile cache: %d formulas  %d hits  %d misses", (int)cache.lru.size(), cache.hits, cache.misses);
+
+		imgui_benchmark_vms();
 
 		ImGui::PopID();
 	}
@@ -1,6 +1,9 @@
 #pragma once
 #include "common.hpp"
 #include "parse.hpp"
+#include "simd.hpp"
+#include "vecmath.hpp"
+#include "interval.hpp"
 
 #define ARGCHECK(funcname, expected_argc) do { \
 	if (argc != expected_argc) { \
@@ -24,15 +27,6 @@ inline float mypow (float a, float b) {
 
 	return powf(a, b);
 }
-inline float mymod (float a, float b) {
-	float val = fmodf(a, b);
-	//if (b > 0.0f) if (a < 0.0f) val += b;
-	//else          if (a > 0.0f) val += b;
-	//
-	if (a*b < 0.0f) // differing sign
-		val += b;
-	return val;
-}
 
 inline const char* exec_sqrt  (int argc, float* args, float* result, const char** errstr) {
 	ARGCHECK("sqrt", 1);
@@ -44,6 +38,11 @@ inline const char* exec_abs   (int argc, float* args, float* result, const char*
 	*result = fabsf(args[0]);
 	return nullptr;
 }
+inline const char* exec_sign  (int argc, float* args, float* result, const char** errstr) {
+	ARGCHECK("sign", 1);
+	*result = mysign(args[0]);
+	return nullptr;
+}
 
 inline const char* exec_mod   (int argc, float* args, float* result, const char** errstr) {
 	ARGCHECK("mod", 2);
@@ -65,6 +64,11 @@ inline const char* exec_round (int argc, float* args, float* result, const char*
 	*result = roundf(args[0]);
 	return nullptr;
 }
+inline const char* exec_ln    (int argc, float* args, float* result, const char** errstr) {
+	ARGCHECK("ln", 1);
+	*result = logf(args[0]);
+	return nullptr;
+}
 
 inline const char* exec_min   (int argc, float* args, float* result, const char** errstr) {
 	if (argc < 2) return "min() takes at least 2 argument!";
@@ -123,53 +127,374 @@ inline const char* exec_atan (DegreeMode const& deg, int argc, float* args, floa
 	return nullptr;
 }
 
+// Lane kernels for the batch evaluator
+// these run over whole lane arrays (one float per sample), result may alias any of the inputs
+// the remaining count % SIMD_WIDTH lanes get padded, so func only ever sees full vectors
+template <typename FUNC>
+inline void lanes_unary (float* result, float const* a, int count, FUNC func) {
+	int i = 0;
+	for (; i <= count - SIMD_WIDTH; i += SIMD_WIDTH)
+		func(vfloat::load(a+i)).store(result+i);
+
+	if (i < count) {
+		float ta[SIMD_WIDTH] = {}, tr[SIMD_WIDTH];
+		memcpy(ta, a+i, (count-i) * sizeof(float));
+		func(vfloat::load(ta)).store(tr);
+		memcpy(result+i, tr, (count-i) * sizeof(float));
+	}
+}
+template <typename FUNC>
+inline void lanes_binary (float* result, float const* a, float const* b, int count, FUNC func) {
+	int i = 0;
+	for (; i <= count - SIMD_WIDTH; i += SIMD_WIDTH)
+		func(vfloat::load(a+i), vfloat::load(b+i)).store(result+i);
+
+	if (i < count) {
+		float ta[SIMD_WIDTH] = {}, tb[SIMD_WIDTH] = {}, tr[SIMD_WIDTH];
+		memcpy(ta, a+i, (count-i) * sizeof(float));
+		memcpy(tb, b+i, (count-i) * sizeof(float));
+		func(vfloat::load(ta), vfloat::load(tb)).store(tr);
+		memcpy(result+i, tr, (count-i) * sizeof(float));
+	}
+}
+template <typename FUNC>
+inline void lanes_ternary (float* result, float const* a, float const* b, float const* c, int count, FUNC func) {
+	int i = 0;
+	for (; i <= count - SIMD_WIDTH; i += SIMD_WIDTH)
+		func(vfloat::load(a+i), vfloat::load(b+i), vfloat::load(c+i)).store(result+i);
+
+	if (i < count) {
+		float ta[SIMD_WIDTH] = {}, tb[SIMD_WIDTH] = {}, tc[SIMD_WIDTH] = {}, tr[SIMD_WIDTH];
+		memcpy(ta, a+i, (count-i) * sizeof(float));
+		memcpy(tb, b+i, (count-i) * sizeof(float));
+		memcpy(tc, c+i, (count-i) * sizeof(float));
+		func(vfloat::load(ta), vfloat::load(tb), vfloat::load(tc)).store(tr);
+		memcpy(result+i, tr, (count-i) * sizeof(float));
+	}
+}
+
+inline void lanes_fill (float* a, float value, int count) {
+	vfloat v = value;
+	int i = 0;
+	for (; i <= count - SIMD_WIDTH; i += SIMD_WIDTH)
+		v.store(a+i);
+	for (; i < count; ++i)
+		a[i] = value;
+}
+
+inline void lanes_pow (float* result, float const* a, float const* b, int count) {
+	// small integer powers (usually all lanes have the same constant exponent) turn into multiplications
+	// a*a is correctly rounded, higher powers are within a few ulp, which is still better than vpow
+	bool uniform_int = b[0] >= -8.0f && b[0] <= 8.0f && b[0] == (float)(int)b[0];
+	int n = uniform_int ? (int)b[0] : 0;
+	for (int i=1; uniform_int && i<count; ++i)
+		uniform_int = b[i] == b[0];
+
+	if (uniform_int) {
+		lanes_unary(result, a, count, [n] (vfloat a) {
+			vfloat res = 1.0f;
+			vfloat base = a;
+			for (int e = n < 0 ? -n : n; e; e >>= 1) {
+				if (e & 1) res = res * base;
+				base = base * base;
+			}
+			return n < 0 ? 1.0f / res : res;
+		});
+	} else {
+		lanes_binary(result, a, b, count, [] (vfloat a, vfloat b) { return vpow(a, b); });
+	}
+}
+
+// batch versions of the std functions, args are lane arrays of count floats each
+inline const char* batch_sqrt  (DegreeMode const& deg, int argc, float const* const* args, float* result, int count) {
+	ARGCHECK("sqrt", 1);
+	lanes_unary(result, args[0], count, [] (vfloat a) { return vsqrt(a); });
+	return nullptr;
+}
+inline const char* batch_abs   (DegreeMode const& deg, int argc, float const* const* args, float* result, int count) {
+	ARGCHECK("abs", 1);
+	lanes_unary(result, args[0], count, [] (vfloat a) { return vabs(a); });
+	return nullptr;
+}
+inline const char* batch_sign  (DegreeMode const& deg, int argc, float const* const* args, float* result, int count) {
+	ARGCHECK("sign", 1);
+	lanes_unary(result, args[0], count, [] (vfloat a) { return vsign(a); });
+	return nullptr;
+}
+
+inline const char* batch_mod   (DegreeMode const& deg, int argc, float const* const* args, float* result, int count) {
+	ARGCHECK("mod", 2);
+	lanes_binary(result, args[0], args[1], count, [] (vfloat a, vfloat b) { return vmod(a, b); });
+	return nullptr;
+}
+inline const char* batch_floor (DegreeMode const& deg, int argc, float const* const* args, float* result, int count) {
+	ARGCHECK("floor", 1);
+	lanes_unary(result, args[0], count, [] (vfloat a) { return vfloor(a); });
+	return nullptr;
+}
+inline const char* batch_ceil  (DegreeMode const& deg, int argc, float const* const* args, float* result, int count) {
+	ARGCHECK("ceil", 1);
+	lanes_unary(result, args[0], count, [] (vfloat a) { return vceil(a); });
+	return nullptr;
+}
+inline const char* batch_round (DegreeMode const& deg, int argc, float const* const* args, float* result, int count) {
+	ARGCHECK("round", 1);
+	lanes_unary(result, args[0], count, [] (vfloat a) { return vround(a); });
+	return nullptr;
+}
+inline const char* batch_ln    (DegreeMode const& deg, int argc, float const* const* args, float* result, int count) {
+	ARGCHECK("ln", 1);
+	lanes_unary(result, args[0], count, [] (vfloat a) { return vlog(a); });
+	return nullptr;
+}
+
+inline const char* batch_min   (DegreeMode const& deg, int argc, float const* const* args, float* result, int count) {
+	if (argc < 2) return "min() takes at least 2 argument!";
+
+	lanes_binary(result, args[0], args[1], count, [] (vfloat a, vfloat b) { return vmin(a, b); });
+	for (int i=2; i<argc; ++i)
+		lanes_binary(result, result, args[i], count, [] (vfloat a, vfloat b) { return vmin(a, b); });
+	return nullptr;
+}
+inline const char* batch_max   (DegreeMode const& deg, int argc, float const* const* args, float* result, int count) {
+	if (argc < 2) return "max() takes at least 2 argument!";
+
+	lanes_binary(result, args[0], args[1], count, [] (vfloat a, vfloat b) { return vmax(a, b); });
+	for (int i=2; i<argc; ++i)
+		lanes_binary(result, result, args[i], count, [] (vfloat a, vfloat b) { return vmax(a, b); });
+	return nullptr;
+}
+inline const char* batch_clamp (DegreeMode const& deg, int argc, float const* const* args, float* result, int count) {
+	ARGCHECK("clamp", 3);
+	lanes_ternary(result, args[0], args[1], args[2], count, [] (vfloat x, vfloat a, vfloat b) { return vmin(vmax(x, a), b); });
+	return nullptr;
+}
+
+inline const char* batch_sin   (DegreeMode const& deg, int argc, float const* const* args, float* result, int count) {
+	ARGCHECK("sin", 1);
+	lanes_unary(result, args[0], count, [&] (vfloat a) { return vsin(a * deg.from_deg_x); });
+	return nullptr;
+}
+inline const char* batch_cos   (DegreeMode const& deg, int argc, float const* const* args, float* result, int count) {
+	ARGCHECK("cos", 1);
+	lanes_unary(result, args[0], count, [&] (vfloat a) { return vcos(a * deg.from_deg_x); });
+	return nullptr;
+}
+inline const char* batch_tan   (DegreeMode const& deg, int argc, float const* const* args, float* result, int count) {
+	ARGCHECK("tan", 1);
+	lanes_unary(result, args[0], count, [&] (vfloat a) { return vtan(a * deg.from_deg_x); });
+	return nullptr;
+}
+inline const char* batch_asin  (DegreeMode const& deg, int argc, float const* const* args, float* result, int count) {
+	ARGCHECK("asin", 1);
+	lanes_unary(result, args[0], count, [&] (vfloat a) { return vasin(a) * deg.to_deg_y; });
+	return nullptr;
+}
+inline const char* batch_acos  (DegreeMode const& deg, int argc, float const* const* args, float* result, int count) {
+	ARGCHECK("acos", 1);
+	lanes_unary(result, args[0], count, [&] (vfloat a) { return vacos(a) * deg.to_deg_y; });
+	return nullptr;
+}
+inline const char* batch_atan  (DegreeMode const& deg, int argc, float const* const* args, float* result, int count) {
+	ARGCHECK("atan", 1);
+	lanes_unary(result, args[0], count, [&] (vfloat a) { return vatan(a) * deg.to_deg_y; });
+	return nullptr;
+}
+
+// interval versions of the std functions, result bounds the function over the argument intervals
+inline const char* interval_sqrt  (DegreeMode const& deg, int argc, Interval const* args, Interval* result) {
+	ARGCHECK("sqrt", 1);
+	*result = ival_sqrt(args[0]);
+	return nullptr;
+}
+inline const char* interval_abs   (DegreeMode const& deg, int argc, Interval const* args, Interval* result) {
+	ARGCHECK("abs", 1);
+	*result = ival_abs(args[0]);
+	return nullptr;
+}
+inline const char* interval_sign  (DegreeMode const& deg, int argc, Interval const* args, Interval* result) {
+	ARGCHECK("sign", 1);
+	*result = ival_monotonic(args[0], mysign);
+	return nullptr;
+}
+
+inline const char* interval_mod   (DegreeMode const& deg, int argc, Interval const* args, Interval* result) {
+	ARGCHECK("mod", 2);
+	*result = ival_mod(args[0], args[1]);
+	return nullptr;
+}
+inline const char* interval_floor (DegreeMode const& deg, int argc, Interval const* args, Interval* result) {
+	ARGCHECK("floor", 1);
+	*result = ival_monotonic(args[0], floorf);
+	return nullptr;
+}
+inline const char* interval_ceil  (DegreeMode const& deg, int argc, Interval const* args, Interval* result) {
+	ARGCHECK("ceil", 1);
+	*result = ival_monotonic(args[0], ceilf);
+	return nullptr;
+}
+inline const char* interval_round (DegreeMode const& deg, int argc, Interval const* args, Interval* result) {
+	ARGCHECK("round", 1);
+	*result = ival_monotonic(args[0], roundf);
+	return nullptr;
+}
+inline const char* interval_ln    (DegreeMode const& deg, int argc, Interval const* args, Interval* result) {
+	ARGCHECK("ln", 1);
+	*result = ival_ln(args[0]);
+	return nullptr;
+}
+
+inline const char* interval_min   (DegreeMode const& deg, int argc, Interval const* args, Interval* result) {
+	if (argc < 2) return "min() takes at least 2 argument!";
+
+	Interval r = args[0];
+	for (int i=1; i<argc; ++i)
+		r = ival_min(r, args[i]);
+
+	*result = r;
+	return nullptr;
+}
+inline const char* interval_max   (DegreeMode const& deg, int argc, Interval const* args, Interval* result) {
+	if (argc < 2) return "max() takes at least 2 argument!";
+
+	Interval r = args[0];
+	for (int i=1; i<argc; ++i)
+		r = ival_max(r, args[i]);
+
+	*result = r;
+	return nullptr;
+}
+inline const char* interval_clamp (DegreeMode const& deg, int argc, Interval const* args, Interval* result) {
+	ARGCHECK("clamp", 3);
+	*result = ival_min(ival_max(args[0], args[1]), args[2]);
+	return nullptr;
+}
+
+inline const char* interval_sin   (DegreeMode const& deg, int argc, Interval const* args, Interval* result) {
+	ARGCHECK("sin", 1);
+	*result = ival_sin(args[0] * Interval(deg.from_deg_x));
+	return nullptr;
+}
+inline const char* interval_cos   (DegreeMode const& deg, int argc, Interval const* args, Interval* result) {
+	ARGCHECK("cos", 1);
+	*result = ival_cos(args[0] * Interval(deg.from_deg_x));
+	return nullptr;
+}
+inline const char* interval_tan   (DegreeMode const& deg, int argc, Interval const* args, Interval* result) {
+	ARGCHECK("tan", 1);
+	*result = ival_tan(args[0] * Interval(deg.from_deg_x));
+	return nullptr;
+}
+inline const char* interval_asin  (DegreeMode const& deg, int argc, Interval const* args, Interval* result) {
+	ARGCHECK("asin", 1);
+	*result = ival_asin(args[0]) * Interval(deg.to_deg_y);
+	return nullptr;
+}
+inline const char* interval_acos  (DegreeMode const& deg, int argc, Interval const* args, Interval* result) {
+	ARGCHECK("acos", 1);
+	*result = ival_acos(args[0]) * Interval(deg.to_deg_y);
+	return nullptr;
+}
+inline const char* interval_atan  (DegreeMode const& deg, int argc, Interval const* args, Interval* result) {
+	ARGCHECK("atan", 1);
+	*result = ival_atan(args[0]) * Interval(deg.to_deg_y);
+	return nullptr;
+}
+
 typedef const char* (*std_function) (int argc, float* args, float* result);
 typedef const char* (*std_angle_function) (DegreeMode const& deg, int argc, float* args, float* result);
+// all batch functions take the DegreeMode, so they can be called without checking angle_func
+typedef const char* (*batch_function) (DegreeMode const& deg, int argc, float const* const* args, float* result, int count);
+typedef const char* (*interval_function) (DegreeMode const& deg, int argc, Interval const* args, Interval* result);
 
 struct StdFunction {
 	void* func_ptr;
 	bool angle_func = false;
+	batch_function batch_func;
+	interval_function interval_func;
 };
 std::unordered_map<std::string_view, StdFunction> std_functions {
-	{ "sqrt",  { (void*)&exec_sqrt  } },
-	{ "abs",   { (void*)&exec_abs   } },
-	{ "min",   { (void*)&exec_min   } },
-	{ "max",   { (void*)&exec_max   } },
-	{ "clamp", { (void*)&exec_clamp } },
-	{ "mod",   { (void*)&exec_mod   } },
-	{ "floor", { (void*)&exec_floor } },
-	{ "ceil",  { (void*)&exec_ceil  } },
-	{ "round", { (void*)&exec_round } },
-
-	{ "sin",   { (void*)&exec_sin  , true } },
-	{ "cos",   { (void*)&exec_cos  , true } },
-	{ "tan",   { (void*)&exec_tan  , true } },
-	{ "asin",  { (void*)&exec_asin , true } },
-	{ "acos",  { (void*)&exec_acos , true } },
-	{ "atan",  { (void*)&exec_atan , true } },
+	{ "sqrt",  { (void*)&exec_sqrt  , false, &batch_sqrt  , &interval_sqrt  } },
+	{ "abs",   { (void*)&exec_abs   , false, &batch_abs   , &interval_abs   } },
+	{ "sign",  { (void*)&exec_sign  , false, &batch_sign  , &interval_sign  } },
+	{ "min",   { (void*)&exec_min   , false, &batch_min   , &interval_min   } },
+	{ "max",   { (void*)&exec_max   , false, &batch_max   , &interval_max   } },
+	{ "clamp", { (void*)&exec_clamp , false, &batch_clamp , &interval_clamp } },
+	{ "mod",   { (void*)&exec_mod   , false, &batch_mod   , &interval_mod   } },
+	{ "floor", { (void*)&exec_floor , false, &batch_floor , &interval_floor } },
+	{ "ceil",  { (void*)&exec_ceil  , false, &batch_ceil  , &interval_ceil  } },
+	{ "round", { (void*)&exec_round , false, &batch_round , &interval_round } },
+	{ "ln",    { (void*)&exec_ln    , false, &batch_ln    , &interval_ln    } },
+
+	{ "sin",   { (void*)&exec_sin   , true , &batch_sin   , &interval_sin   } },
+	{ "cos",   { (void*)&exec_cos   , true , &batch_cos   , &interval_cos   } },
+	{ "tan",   { (void*)&exec_tan   , true , &batch_tan   , &interval_tan   } },
+	{ "asin",  { (void*)&exec_asin  , true , &batch_asin  , &interval_asin  } },
+	{ "acos",  { (void*)&exec_acos  , true , &batch_acos  , &interval_acos  } },
+	{ "atan",  { (void*)&exec_atan  , true , &batch_atan  , &interval_atan  } },
 };
 
+// std function with the name sym, null for any other name
+inline StdFunction const* find_builtin (Symbol sym) {
+	// indexed by Symbol, interning all the std function names on first use
+	static const std::vector<StdFunction const*> builtins = [] () {
+		std::vector<StdFunction const*> table;
+		for (auto& it : std_functions) {
+			Symbol s = symbols.intern(it.first);
+			if (s >= table.size()) table.resize(s+1, nullptr);
+			table[s] = &it.second;
+		}
+		return table;
+	}();
+	return sym < builtins.size() ? builtins[sym] : nullptr;
+}
+
+// symbols of the std function names, for code that needs to know specific functions (like the Differentiator)
+struct BuiltinSymbols {
+	Symbol sqrt, abs, sign, min, max, clamp, mod, floor, ceil, round, ln;
+	Symbol sin, cos, tan, asin, acos, atan;
+};
+inline BuiltinSymbols const& builtin_symbols () {
+	static const BuiltinSymbols syms = {
+		symbols.intern("sqrt"), symbols.intern("abs"), symbols.intern("sign"), symbols.intern("min"), symbols.intern("max"),
+		symbols.intern("clamp"), symbols.intern("mod"), symbols.intern("floor"), symbols.intern("ceil"), symbols.intern("round"), symbols.intern("ln"),
+		symbols.intern("sin"), symbols.intern("cos"), symbols.intern("tan"), symbols.intern("asin"), symbols.intern("acos"), symbols.intern("atan"),
+	};
+	return syms;
+}
+
+// evaluate a std function call with constant args at compile time
+// false if that's not possible (user function, angle function that depends on the degree mode, or error)
 inline bool call_const_func (Operation& op, float* args, float* result) {
-	auto it = std_functions.find(op.text);
-	if (it == std_functions.end() || it->second.angle_func)
+	auto* builtin = find_builtin(op.sym);
+	if (!builtin || builtin->angle_func)
 		return false;
 
-	auto func = (std_function)it->second.func_ptr;
-	return func(op.argc, args, result) != nullptr;
+	auto func = (std_function)builtin->func_ptr;
+	return func(op.argc, args, result) == nullptr;
 }
 
 
-struct Evaluator {
+// The original stack machine interpreter, executes the stack code (Operation) directly
+// only kept as a reference to compare the register VM against (see benchmark_vms)
+struct StackEvaluator {
 	DegreeMode deg_mode;
 
+	// variables and functions are indexed by equation index, which OP_VARIABLE and OP_FUNCCALL get linked to
+	// (sized to the number of equations, entries of equations that are not variables/functions stay invalid)
+
 	// variables that are constant over the function
-	std::unordered_map<std::string_view, float> var_values;
+	struct Variable {
+		float                                      value;
+		bool                                       valid = false;
+	};
+	std::vector<Variable> var_values;
 
 	struct Function {
-		EquationDef*                               def;
-		std::vector<Operation>*                    ops;
+		EquationDef*                               def = nullptr;
+		std::vector<Operation>*                    ops = nullptr;
 	};
-	std::unordered_map<std::string_view, Function> functions;
+	std::vector<Function> functions;
 
 	int frame_ptr;
 	int stack_ptr;
@@ -182,24 +507,16 @@ struct Evaluator {
 	//StackValue stack[STACK_SIZE];
 	std::vector<StackValue> stack = std::vector<StackValue>(STACK_SIZE);
 
-	bool lookup_arg (std::string_view const& name, float* value, EquationDef& funcdef) {
-		auto arg_i = funcdef.arg_map.find(name);
-		if (arg_i == funcdef.arg_map.end())
+	bool lookup_var (int index, float* value) {
+		if (index < 0 || !var_values[index].valid)
 			return false;
-
-		assert(arg_i->second >= 0 && arg_i->second < (int)funcdef.arg_map.size());
-		assert(frame_ptr + arg_i->second < stack_ptr);
-
-		*value = stack[frame_ptr + arg_i->second].f;
-
+		*value = var_values[index].value;
 		return true;
 	}
-	bool lookup_var (std::string_view const& name, float* value) {
-		auto var = var_values.find(name);
-		if (var == var_values.end())
-			return false;
-		*value = var->second;
-		return true;
+	Function* lookup_function (int index) {
+		if (index < 0 || !functions[index].def)
+			return nullptr;
+		return &functions[index];
 	}
 
 #define PUSH(val) \
@@ -210,27 +527,24 @@ struct Evaluator {
 	if (stack_ptr < (N)) return "stack underflow!"; \
 	stack_ptr -= (N)
 
-	const char* call_function (Operation& op, float* result) {
-		auto it = std_functions.find(op.text);
-		if (it != std_functions.end()) {
+	const char* call_builtin (Operation& op, float* result) {
+		POP(op.argc);
+		float* args = &stack[stack_ptr].f;
 
-			POP(op.argc);
-			float* args = &stack[stack_ptr].f;
-
-			if (it->second.angle_func) {
-				auto func = (std_angle_function)it->second.func_ptr;
-				return func(deg_mode, op.argc, args, result);
-			} else {
-				auto func = (std_function)it->second.func_ptr;
-				return func(op.argc, args, result);
-			}
+		if (op.builtin->angle_func) {
+			auto func = (std_angle_function)op.builtin->func_ptr;
+			return func(deg_mode, op.argc, args, result);
+		} else {
+			auto func = (std_function)op.builtin->func_ptr;
+			return func(op.argc, args, result);
 		}
+	}
 
-		auto funcit = functions.find(op.text);
-		if (funcit != functions.end()) {
-			auto& func = funcit->second;
+	const char* call_function (Operation& op, float* result) {
+		if (auto* funcp = lookup_function(op.index)) {
+			auto& func = *funcp;
 
-			if (op.argc != (int)func.def->arg_map.size()) {
+			if (op.argc != (int)func.def->args.size()) {
 				return "function argument count does not match!";
 			}
 
@@ -265,14 +579,27 @@ struct Evaluator {
 					value = op.value;
 				} break;
 
+				case OP_ARGUMENT: {
+					assert(frame_ptr + op.index < stack_ptr);
+					value = stack[frame_ptr + op.index].f;
+				} break;
+
 				case OP_VARIABLE: {
-					if (lookup_arg(op.text, &value, funcdef)) {
+					if (!lookup_var(op.index, &value))
+						return "lookup_var() failed!";
+				} break;
 
-					} else if (lookup_var(op.text, &value)) {
+				case OP_LOAD_TEMP: {
+					// temps are on the stack right after the arguments
+					int offs = (int)funcdef.args.size() + op.index;
+					assert(frame_ptr + offs < stack_ptr);
+					value = stack[frame_ptr + offs].f;
+				} break;
 
-					} else {
-						return "lookup_var() failed!";
-					}
+				case OP_DROP_TEMPS: {
+					POP(1);
+					value = stack[stack_ptr].f;
+					POP(op.argc);
 				} break;
 
 				case OP_FUNCCALL: {
@@ -281,6 +608,12 @@ struct Evaluator {
 
 				} break;
 
+				case OP_BUILTIN: {
+					auto err = call_builtin(op, &value);
+					if (err) return err;
+
+				} break;
+
 				case OP_UNARY_NEGATE: {
 					POP(1);
 					float a = stack[stack_ptr].f;
@@ -319,7 +652,7 @@ struct Evaluator {
 	}
 
 	const char* execute (EquationDef& funcdef, std::vector<Operation>& ops, float x, float* result) {
-		int argc = (int)funcdef.arg_map.size();
+		int argc = (int)funcdef.args.size();
 		assert(argc <= 1);
 
 		stack_ptr = 0;
@@ -348,7 +681,463 @@ struct Evaluator {
 		}
 		return true;
 	}
+
+};
+
+/*
+	Register VM
+
+	Three-address register code, generated from the stack code by emit_regcode (codegen.hpp)
+	Registers of a function call frame are laid out as
+	  [0, argc)                   arguments
+	  [argc, stack_base)          constants (copied from RegCode::consts on entry)
+	  [stack_base, reg_count)     temporaries, one per stack depth of the stack code
+	so values, arguments and constants never need an op, they are simply operands
+
+	Function calls pass their arguments in consecutive registers, which become the registers [0, argc) of the callee frame,
+	so calls don't need to copy arguments
+*/
+enum RegOPType : uint8_t {
+	ROP_MOV,          // dst = a
+	ROP_LOAD_VAR,     // dst = variable (index: name slot)
+
+	ROP_CALL,         // dst = func(a .. a+argc) (index: name slot)
+	ROP_BUILTIN,      // dst = builtin(a .. a+argc)
+
+	ROP_ADD,          // dst = a + b
+	ROP_SUBSTRACT,    // dst = a - b
+	ROP_MULTIPLY,     // dst = a * b
+	ROP_DIVIDE,       // dst = a / b
+	ROP_POW,          // dst = a ^ b
+
+	ROP_NEGATE,       // dst = -a
+
+	ROP_RETURN,       // end of code, result is in RegCode::result
 };
+inline constexpr const char* RegOPType_str[] = {
+	"MOV",
+	"LOAD_VAR",
+
+	"CALL",
+	"BUILTIN",
+
+	"ADD",
+	"SUBSTRACT",
+	"MULTIPLY",
+	"DIVIDE",
+	"POW",
+
+	"NEGATE",
+
+	"RETURN",
+};
+
+typedef uint16_t reg_t;
+
+struct RegOp {
+	RegOPType          code;
+	uint8_t            argc; // ROP_CALL, ROP_BUILTIN
+
+	reg_t              dst;
+	reg_t              a, b;
+
+	union {
+		int                index;   // ROP_LOAD_VAR, ROP_CALL: slot in RegCode::names
+		StdFunction const* builtin; // ROP_BUILTIN
+	};
+};
+
+struct RegCode {
+	std::vector<RegOp>            ops; // always ends in ROP_RETURN
+	std::vector<float>            consts;
+
+	// names of referenced variables and functions, links are the equation indices they resolve to (-1 if unresolved)
+	// linked by Equations::link_code
+	std::vector<Symbol>           names;
+	std::vector<int>              links;
+
+	int                           argc = 0;
+	int                           reg_count = 0; // number of registers needed for one frame, computed by emit_regcode
+	reg_t                         result = 0;
+};
+
+#if defined(__GNUC__) || defined(__clang__)
+	// use computed goto to jump from op to op directly (threaded dispatch)
+	// each op gets its own indirect jump, which predicts much better than the single jump of a switch
+	#define VM_THREADED_DISPATCH 1
+#else
+	#define VM_THREADED_DISPATCH 0
+#endif
+
+struct Evaluator {
+	DegreeMode deg_mode;
+
+	// variables and functions are indexed by equation index, which RegCode::links point to
+	// (sized to the number of equations, entries of equations that are not variables/functions stay invalid)
+
+	// variables that are constant over the function
+	struct Variable {
+		float                                      value;
+		bool                                       valid = false;
+	};
+	std::vector<Variable> var_values;
+
+	struct Function {
+		EquationDef*                               def = nullptr;
+		RegCode*                                   code = nullptr;
+	};
+	std::vector<Function> functions;
+
+	static constexpr int MAX_REGS = 128;
+
+	// register file, the frames of nested function calls are stacked in here
+	std::vector<float> regs = std::vector<float>(MAX_REGS);
+
+	// evaluate the same program as another evaluator, but with separate registers, so that both can run on different threads at once
+	void share_program (Evaluator const& r) {
+		deg_mode   = r.deg_mode;
+		var_values = r.var_values;
+		functions  = r.functions;
+	}
+
+	bool lookup_var (RegCode const& code, int name, float* value) {
+		int index = code.links[name];
+		if (index < 0 || !var_values[index].valid)
+			return false;
+		*value = var_values[index].value;
+		return true;
+	}
+	Function* lookup_function (RegCode const& code, int name) {
+		int index = code.links[name];
+		if (index < 0 || !functions[index].code)
+			return nullptr;
+		return &functions[index];
+	}
+
+	// execute code with the frame starting at register <base>, arguments need to be in the first argc registers
+	const char* execute (RegCode const& code, int base) {
+		if (base + code.reg_count > MAX_REGS)
+			return "stack overflow!";
+
+		float* r = &regs[base];
+		if (!code.consts.empty())
+			memcpy(r + code.argc, code.consts.data(), code.consts.size() * sizeof(float));
+
+		RegOp const* op = code.ops.data();
+
+	#if VM_THREADED_DISPATCH
+		static void* const dispatch_table[] = { // needs to match RegOPType
+			&&L_ROP_MOV,
+			&&L_ROP_LOAD_VAR,
+			&&L_ROP_CALL,
+			&&L_ROP_BUILTIN,
+			&&L_ROP_ADD,
+			&&L_ROP_SUBSTRACT,
+			&&L_ROP_MULTIPLY,
+			&&L_ROP_DIVIDE,
+			&&L_ROP_POW,
+			&&L_ROP_NEGATE,
+			&&L_ROP_RETURN,
+		};
+		#define VM_CASE(name) L_##name:
+		#define VM_NEXT() goto *dispatch_table[(++op)->code]
+
+		goto *dispatch_table[op->code];
+	#else
+		#define VM_CASE(name) case name:
+		#define VM_NEXT() ++op; continue
+
+		for (;;) switch (op->code) {
+	#endif
+
+		VM_CASE(ROP_MOV) {
+			r[op->dst] = r[op->a];
+			VM_NEXT();
+		}
+		VM_CASE(ROP_LOAD_VAR) {
+			if (!lookup_var(code, op->index, &r[op->dst]))
+				return "lookup_var() failed!";
+			VM_NEXT();
+		}
+
+		VM_CASE(ROP_CALL) {
+			auto* func = lookup_function(code, op->index);
+			if (!func) return "unknown function!";
+
+			if (op->argc != func->code->argc)
+				return "function argument count does not match!";
+
+			auto err = execute(*func->code, base + op->a);
+			if (err) return err;
+
+			r[op->dst] = r[op->a + func->code->result];
+			VM_NEXT();
+		}
+		VM_CASE(ROP_BUILTIN) {
+			const char* err;
+			if (op->builtin->angle_func) {
+				auto func = (std_angle_function)op->builtin->func_ptr;
+				err = func(deg_mode, op->argc, &r[op->a], &r[op->dst]);
+			} else {
+				auto func = (std_function)op->builtin->func_ptr;
+				err = func(op->argc, &r[op->a], &r[op->dst]);
+			}
+			if (err) return err;
+			VM_NEXT();
+		}
+
+		VM_CASE(ROP_ADD      ) { r[op->dst] = r[op->a] + r[op->b];       VM_NEXT(); }
+		VM_CASE(ROP_SUBSTRACT) { r[op->dst] = r[op->a] - r[op->b];       VM_NEXT(); }
+		VM_CASE(ROP_MULTIPLY ) { r[op->dst] = r[op->a] * r[op->b];       VM_NEXT(); }
+		VM_CASE(ROP_DIVIDE   ) { r[op->dst] = r[op->a] / r[op->b];       VM_NEXT(); }
+		VM_CASE(ROP_POW      ) { r[op->dst] = mypow(r[op->a], r[op->b]); VM_NEXT(); }
+
+		VM_CASE(ROP_NEGATE   ) { r[op->dst] = -r[op->a];                 VM_NEXT(); }
+
+		VM_CASE(ROP_RETURN) {
+			return nullptr;
+		}
+
+	#if !VM_THREADED_DISPATCH
+			default: return "unknown op type!";
+		}
+	#endif
+		#undef VM_CASE
+		#undef VM_NEXT
+	}
+
+	const char* execute (RegCode const& code, float x, float* result) {
+		assert(code.argc <= 1);
+
+		regs[0] = x; // only used if argc == 1
+
+		const char* err = execute(code, 0);
+		if (err) return err;
+
+		*result = regs[code.result];
+		return nullptr;
+	}
+
+	bool execute (RegCode const& code, float x, float* result, std::string* last_error) {
+		auto err = execute(code, x, result);
+		if (err) {
+			*last_error = err;
+			return false;
+		}
+		return true;
+	}
+
+	// Batch evaluation
+	// evaluates an equation for a whole array of x values
+	// each op is executed for BATCH_SIZE samples at once, with every register holding one float per sample (struct of arrays)
+	// this amortizes the op dispatch over the whole batch (so a plain switch is fine here), and lets the ops run as simd lane kernels
+	static constexpr int BATCH_SIZE = 256;
+
+	int batch_lanes; // number of valid lanes in the current batch
+
+	std::vector<float> batch_regs = std::vector<float>(MAX_REGS * BATCH_SIZE);
+	std::vector<float const*> batch_args;
+
+	float* lanes (int reg) {
+		return &batch_regs[reg * BATCH_SIZE];
+	}
+
+	const char* execute_batch (RegCode const& code, int base) {
+		if (base + code.reg_count > MAX_REGS)
+			return "stack overflow!";
+
+		for (int i=0; i<(int)code.consts.size(); ++i)
+			lanes_fill(lanes(base + code.argc + i), code.consts[i], batch_lanes);
+
+		for (auto& op : code.ops) {
+			float* dst = lanes(base + op.dst);
+			float* a   = lanes(base + op.a);
+			float* b   = lanes(base + op.b);
+
+			switch (op.code) {
+				case ROP_MOV: {
+					memcpy(dst, a, batch_lanes * sizeof(float));
+				} break;
+
+				case ROP_LOAD_VAR: {
+					float value;
+					if (!lookup_var(code, op.index, &value))
+						return "lookup_var() failed!";
+					lanes_fill(dst, value, batch_lanes);
+				} break;
+
+				case ROP_CALL: {
+					auto* func = lookup_function(code, op.index);
+					if (!func) return "unknown function!";
+
+					if (op.argc != func->code->argc)
+						return "function argument count does not match!";
+
+					auto err = execute_batch(*func->code, base + op.a);
+					if (err) return err;
+
+					float* res = lanes(base + op.a + func->code->result);
+					if (res != dst)
+						memcpy(dst, res, batch_lanes * sizeof(float));
+				} break;
+
+				case ROP_BUILTIN: {
+					batch_args.resize(op.argc);
+					for (int i=0; i<op.argc; ++i)
+						batch_args[i] = lanes(base + op.a + i);
+
+					// lane kernels allow the result to alias the arguments
+					auto err = op.builtin->batch_func(deg_mode, op.argc, batch_args.data(), dst, batch_lanes);
+					if (err) return err;
+				} break;
+
+				case ROP_ADD       : lanes_binary(dst, a, b, batch_lanes, [] (vfloat a, vfloat b) { return a + b; }); break;
+				case ROP_SUBSTRACT : lanes_binary(dst, a, b, batch_lanes, [] (vfloat a, vfloat b) { return a - b; }); break;
+				case ROP_MULTIPLY  : lanes_binary(dst, a, b, batch_lanes, [] (vfloat a, vfloat b) { return a * b; }); break;
+				case ROP_DIVIDE    : lanes_binary(dst, a, b, batch_lanes, [] (vfloat a, vfloat b) { return a / b; }); break;
+				case ROP_POW       : lanes_pow(dst, a, b, batch_lanes); break;
+
+				case ROP_NEGATE    : lanes_unary(dst, a, batch_lanes, [] (vfloat a) { return -a; }); break;
+
+				case ROP_RETURN: {
+					return nullptr;
+				}
+
+				default: {
+					return "unknown op type!";
+				}
+			}
+		}
+
+		return nullptr;
+	}
+
+	const char* execute_batch (RegCode const& code, float const* xs, float* results, int count) {
+		assert(code.argc <= 1);
+
+		for (int offs=0; offs<count; offs += BATCH_SIZE) {
+			batch_lanes = min(count - offs, BATCH_SIZE);
+
+			if (code.argc == 1)
+				memcpy(lanes(0), xs + offs, batch_lanes * sizeof(float));
+
+			const char* err = execute_batch(code, 0);
+			if (err) return err;
+
+			memcpy(results + offs, lanes(code.result), batch_lanes * sizeof(float));
+		}
+
+		return nullptr;
+	}
+
+	bool execute_batch (RegCode const& code, float const* xs, float* results, int count, std::string* last_error) {
+		auto err = execute_batch(code, xs, results, count);
+		if (err) {
+			*last_error = err;
+			return false;
+		}
+		return true;
+	}
+
+	// Interval evaluation
+	// evaluates an equation over a whole range of x at once, the result bounds all the values the equation takes over the range
+	// (see interval.hpp), which lets the sampler skip ranges that are off screen or flat without sampling them
+	// bounds are only as tight as the interval rules allow, values that occur multiple times (x - x) are not correlated
+	std::vector<Interval> interval_regs = std::vector<Interval>(MAX_REGS);
+
+	const char* execute_interval (RegCode const& code, int base) {
+		if (base + code.reg_count > MAX_REGS)
+			return "stack overflow!";
+
+		Interval* r = &interval_regs[base];
+		for (int i=0; i<(int)code.consts.size(); ++i)
+			r[code.argc + i] = Interval(code.consts[i]);
+
+		for (auto& op : code.ops) {
+			switch (op.code) {
+				case ROP_MOV: {
+					r[op.dst] = r[op.a];
+				} break;
+
+				case ROP_LOAD_VAR: {
+					float value;
+					if (!lookup_var(code, op.index, &value))
+						return "lookup_var() failed!";
+					r[op.dst] = Interval(value);
+				} break;
+
+				case ROP_CALL: {
+					auto* func = lookup_function(code, op.index);
+					if (!func) return "unknown function!";
+
+					if (op.argc != func->code->argc)
+						return "function argument count does not match!";
+
+					auto err = execute_interval(*func->code, base + op.a);
+					if (err) return err;
+
+					r[op.dst] = r[op.a + func->code->result];
+				} break;
+
+				case ROP_BUILTIN: {
+					auto err = op.builtin->interval_func(deg_mode, op.argc, &r[op.a], &r[op.dst]);
+					if (err) return err;
+				} break;
+
+				case ROP_ADD       : r[op.dst] = r[op.a] + r[op.b]; break;
+				case ROP_SUBSTRACT : r[op.dst] = r[op.a] - r[op.b]; break;
+				case ROP_MULTIPLY  : r[op.dst] = r[op.a] * r[op.b]; break;
+				case ROP_DIVIDE    : r[op.dst] = r[op.a] / r[op.b]; break;
+				case ROP_POW       : r[op.dst] = ival_pow(r[op.a], r[op.b]); break;
+
+				case ROP_NEGATE    : r[op.dst] = -r[op.a]; break;
+
+				case ROP_RETURN: {
+					return nullptr;
+				}
+
+				default: {
+					return "unknown op type!";
+				}
+			}
+		}
+
+		return nullptr;
+	}
+
+	const char* execute_interval (RegCode const& code, Interval x, Interval* result) {
+		assert(code.argc <= 1);
+
+		interval_regs[0] = x; // only used if argc == 1
+
+		const char* err = execute_interval(code, 0);
+		if (err) return err;
+
+		*result = interval_regs[code.result];
+		return nullptr;
+	}
+};
+
+// disassemble register code for debugging
+inline std::string dbg_regcode (RegCode const& code) {
+	std::string str = prints("regs: %d  consts: [", code.reg_count);
+	for (size_t i=0; i<code.consts.size(); ++i)
+		str += prints(i > 0 ? ", r%d=%g" : "r%d=%g", code.argc + (int)i, code.consts[i]);
+	str += "]\n";
+
+	for (auto& op : code.ops) {
+		switch (op.code) {
+			case ROP_MOV:      str += prints("  r%d = r%d\n", op.dst, op.a); break;
+			case ROP_LOAD_VAR: { auto name = symbols.name(code.names[op.index]); str += prints("  r%d = %.*s\n", op.dst, (int)name.size(), name.data()); } break;
+			case ROP_CALL:     { auto name = symbols.name(code.names[op.index]); str += prints("  r%d = %.*s(r%d..%d)\n", op.dst, (int)name.size(), name.data(), op.a, op.a + op.argc); } break;
+			case ROP_BUILTIN:  str += prints("  r%d = builtin(r%d..%d)\n", op.dst, op.a, op.a + op.argc); break;
+			case ROP_NEGATE:   str += prints("  r%d = -r%d\n", op.dst, op.a); break;
+			case ROP_RETURN:   str += prints("  return r%d\n", code.result); break;
+			default:           str += prints("  r%d = %s r%d r%d\n", op.dst, RegOPType_str[op.code], op.a, op.b); break;
+		}
+	}
+	return str;
+}
 
 // eval as a string to quickly debug execution
 bool execute_str (std::vector<Operation>& ops, std::string* result) {
@@ -363,11 +1152,30 @@ bool execute_str (std::vector<Operation>& ops, std::string* result) {
 				value = prints("%g", op.value);
 			} break;
 
-			case OP_VARIABLE: {
+			case OP_VARIABLE:
+			case OP_ARGUMENT: {
 				value = (std::string)op.text;
 			} break;
 
-			case OP_FUNCCALL: {
+			case OP_LOAD_TEMP: {
+				value = prints("t%d", op.index);
+			} break;
+
+			case OP_DROP_TEMPS: {
+				if (stack.size() < op.argc + 1) {
+					return false;
+				}
+				// list the temps before the expression using them
+				int first = (int)stack.size() - 1 - op.argc;
+				for (int i=0; i<op.argc; ++i)
+					value += prints("t%d = %s; ", i, stack[first + i].c_str());
+				value += stack.back();
+
+				stack.resize(first);
+			} break;
+
+			case OP_FUNCCALL:
+			case OP_BUILTIN: {
 				if (stack.size() < op.argc) {
 					return false;
 				}
@@ -1,5 +1,6 @@
 #include "common_app.hpp"
 #include "equations.hpp"
+#include "async_sampler.hpp"
 #include <array>
 
 struct AxisUnits {
@@ -275,6 +276,15 @@ struct App : public IApp {
 		if (ImGui::TreeNode("Graphics")) {
 			ImGui::DragFloat("text_size", &text_size, 0.05f, 0, 64);
 			ImGui::DragFloat("equation_res", &eq_res_px, 0.02f);
+			ImGui::SliderInt("adaptive_depth", &adaptive_depth, 0, 8);
+			ImGui::DragFloat("adaptive_tolerance", &adaptive_tol_px, 0.01f, 0.01f, 8);
+			ImGui::DragInt("adaptive_budget", &adaptive_budget, 64, 0, 1<<20);
+			ImGui::SliderInt("coarse_passes", &coarse_passes, 0, 4);
+			ImGui::DragFloat("frame_budget_ms", &frame_budget_ms, 0.1f, -1, 100);
+			ImGui::SliderInt("sample_threads", &sample_thread_count, 0, 64);
+			ImGui::Text("request %d, showing %d%s", last_request.id, sampled.id, sampler.busy() ? " (sampling)" : "");
+			ImGui::Text("last result: %.2f ms, %d tile jobs, %d refine jobs", sampled.time_ms, sampled.tile_jobs, sampled.refine_jobs);
+			ImGui::Text("last refine: %d evaluations, %d bounds (%d culled), %d cuts", sampled.evaluations, sampled.bounds, sampled.culled, sampled.cuts);
 
 			ImGui::Checkbox("axis_line_antialis", &axis_line_aa);
 			ImGui::SliderFloat("axis_line_thickness", &axis_line_w, 0.5f, 8);
@@ -306,6 +316,12 @@ struct App : public IApp {
 
 	float eq_res_px = 1;
 
+	// adaptive sampling: curves start adaptive_depth levels (each 2x) coarser than eq_res_px
+	// and intervals are halved while their midpoint is more than adaptive_tol_px off the chord, evaluating at most adaptive_budget midpoints per curve
+	int   adaptive_depth = 3;
+	float adaptive_tol_px = 0.25f;
+	int   adaptive_budget = 16384;
+
 	float ticks_px = 7.0f;
 
 	float4 col_ticks_text = float4(0.8f,0.8f,0.8f,1);
@@ -480,40 +496,38 @@ struct App : public IApp {
 
 	int clicked_eq = -1;
 
+	// curves are sampled in the background (see AsyncSampler), frames keep drawing the last completed result
+	AsyncSampler  sampler;
+	SampleResult  sampled;
+	SampleRequest last_request = {};
+
+	std::shared_ptr<SampleProgram const> sample_program; // snapshot of equations.program
+	int  sample_program_version = -1;
+	bool sample_program_jit;
+
+	int   sample_thread_count = 0; // 0: one per hardware thread
+
+	// curves are first sampled coarse_passes levels (each 2x) coarser than eq_res_px, then refined progressively
+	int   coarse_passes = 3;
+	// how long frames wait for sampling to complete, afterwards they draw the latest progress (< 0: always wait, 0: never)
+	float frame_budget_ms = 4;
+
 	int hover_eq = -1;
 	float2 hover_point = -1;
 
 	void draw_equations (Input& I, View3D const& view) {
 		ZoneScoped;
 		
-		Evaluator eval;
-		eval.deg_mode.from_deg_x = axes[0].units->deg ? DEG_TO_RAD : 1;
-		eval.deg_mode.to_deg_y   = axes[1].units->deg ? RAD_TO_DEG : 1;
+		DegreeMode deg_mode;
+		deg_mode.from_deg_x = axes[0].units->deg ? DEG_TO_RAD : 1;
+		deg_mode.to_deg_y   = axes[1].units->deg ? RAD_TO_DEG : 1;
 
-		// sort variables such that dependencies are always first
-		std::vector<int> sorted_equations;
-		equations.dependency_sort(&sorted_equations);
+		// rebuild the program (code, variable values and jit kernels) only if anything changed
+		equations.update_code(deg_mode);
 
-		bool dbg = ImGui::TreeNode("Debug Equations");
+		auto& eval = equations.program.eval;
 
-		for (int eq_i : sorted_equations) {
-			auto& eq = equations.equations[eq_i];
-
-			if (eq.def.is_variable) {
-				if (dbg) {
-					dbg_equation(eq);
-					ImGui::Separator();
-				}
-
-				float value;
-				eq.exec_valid = eval.execute(eq.def, eq.ops, 0, &value, &eq.last_err);
-				if (eq.exec_valid)
-					eval.var_values.emplace(eq.def.name, value);
-			} else {
-				if (eq.exec_valid && equations.name_map.find(eq.def.name) != equations.name_map.end()) // don't insert ambiguous names
-					eval.functions.emplace(eq.def.name, Evaluator::Function{ &eq.def, &eq.ops });
-			}
-		}
+		bool dbg = ImGui::TreeNode("Debug Equations");
 
 		// Plot functions by evaluating them for all desired x values
 		// and handle curve hover points
@@ -545,59 +559,99 @@ struct App : public IApp {
 		};
 
 		eq_res_px = max(eq_res_px, 1.0f / 8);
+		adaptive_depth = clamp(adaptive_depth, 0, 8);
 
-		float res = px2world.x * eq_res_px;
+		// finest sample spacing: the power of two spacing at or below the requested resolution, so that samples line up with the cached tiles
+		// curves start from the uniform samples adaptive_depth levels coarser and are only refined down to this where they bend
+		int   level = SampleTiles::level_for(px2world.x * eq_res_px) + adaptive_depth;
+		float res   = SampleTiles::spacing(level);
 		int start = floori(view0.x / res), end = ceili(view1.x / res);
 
-		for (int eq_i=0; eq_i<(int)equations.equations.size(); ++eq_i) {
-			auto& eq = equations.equations[eq_i];
+		float tol = adaptive_tol_px * px2world.y;
 
-			if (dbg) {
-				dbg_equation(eq);
-				ImGui::Separator();
-			}
+		// curves are culled against the view plus one view height above and below, snapped to multiples of the view height,
+		// so that small vertical pans don't need to refine again
+		float view_h = view1.y - view0.y;
+		float2 cull_y = float2(floorf(view0.y / view_h) - 1.0f, ceilf(view1.y / view_h) + 1.0f) * view_h;
 
-			// only plot functions with zero or one arguments (plot f(b) for convinience even though b!=x)
-			// don't plot f=5 for example
-			bool show = eq.enable && eq.valid && !eq.def.is_variable && eq.def.arg_map.size() <= 1;
-			if (!show) continue;
+		bool log_x = axes[0].units->log, log_y = axes[1].units->log;
 
-			ZoneScopedN("draw equation");
+		// only plot functions with zero or one arguments (plot f(b) for convinience even though b!=x)
+		// don't plot f=5 for example
+		auto show = [&] (Equation& eq) {
+			return eq.enable && eq.valid && !eq.def.is_variable && eq.def.args.size() <= 1;
+		};
 
-			auto eval_func = [&] (Equation& eq, float x, float* result) {
-				if (axes[0].units->log)
-					x = powf(10.0f, x);
+		if (!sample_program || sample_program_version != equations.program.version || sample_program_jit != Equation::use_jit) {
+			sample_program = std::make_shared<SampleProgram>(equations, Equation::use_jit);
+			sample_program_version = equations.program.version;
+			sample_program_jit = Equation::use_jit;
+		}
 
-				eq.exec_valid = eval.execute(eq.def, eq.ops, x, result, &eq.last_err);
+		SampleRequest req = {};
+		req.id      = last_request.id + 1;
+		req.program = sample_program;
+		req.view    = { level, start, end, adaptive_depth, tol, adaptive_budget, cull_y, log_x, log_y, coarse_passes };
+		req.threads = sample_thread_count;
+		req.focus_x = clamp((cursor * px2world + view0).x, view0.x, view1.x);
+		for (int eq_i=0; eq_i<(int)equations.equations.size(); ++eq_i) {
+			auto& eq = equations.equations[eq_i];
+			if (show(eq) && eq.exec_valid && eval.functions[eq_i].code)
+				req.plot.push_back(eq_i);
+		}
 
-				if (axes[1].units->log)
-					*result = log10f(*result);
+		// submit only if anything changed, so idle frames don't sample anything
+		if (!req.same(last_request)) {
+			last_request = req;
+			sampler.submit(std::move(req));
+		}
+		// give sampling up to frame_budget_ms to complete, so that cheap changes still show up in the same frame
+		if (frame_budget_ms != 0 && (sampled.id != last_request.id || sampled.pass > 0))
+			sampler.wait(last_request.id, frame_budget_ms);
+
+		if (sampler.poll(&sampled)) {
+			// evaluation errors are only found while sampling
+			for (auto& e : sampled.errors) {
+				for (auto& eq : equations.equations) {
+					if (eq.code_stamp == e.code_stamp) {
+						eq.exec_valid = false;
+						eq.last_err = e.err;
+					}
+				}
+			}
+		}
 
-			};
+		if (dbg) {
+			ImGui::Text("sampling: request %d, showing %d at %dx eq_res_px, %3.0f%% done", last_request.id, sampled.id, 1 << sampled.pass, sampled.progress * 100);
+			ImGui::ProgressBar(sampled.id == last_request.id ? sampled.progress : 0.0f);
+			ImGui::Separator();
+		}
 
-			eq_lines[eq_i] = lines.begin_draw(eq.line_w);
+		for (int eq_i=0; eq_i<(int)equations.equations.size(); ++eq_i) {
+			auto& eq = equations.equations[eq_i];
 
-			if (!eq.exec_valid) continue;
+			if (dbg) {
+				dbg_equation(eq);
+				ImGui::Separator();
+			}
+
+			if (!show(eq)) continue;
 
-			float prev_x = (float)start * res;
-			float prev_y;
-			eval_func(eq, prev_x, &prev_y);
+			eq_lines[eq_i] = lines.begin_draw(eq.line_w);
 
-			for (int i=start+1; eq.exec_valid && i<=end; ++i) {
-				float plot_x = (float)i * res;
-				float plot_y;
-				eval_func(eq, plot_x, &plot_y);
+			// curves of edited equations only show up once they are sampled
+			auto* curve = sampled.find(eq.code_stamp);
+			if (!eq.exec_valid || !curve) continue;
 
-				if (!eq.exec_valid) break;
+			for (size_t i=1; i<curve->points.size(); ++i) {
+				float2 a = curve->points[i-1];
+				float2 b = curve->points[i];
 
-				if (!isnan(prev_y) && !isnan(plot_y)) {
-					eq_lines[eq_i].vertex_count += lines.draw_line(float3(prev_x, prev_y, 0), float3(plot_x, plot_y, 0), eq.col);
+				if (!isnan(a.y) && !isnan(b.y)) {
+					eq_lines[eq_i].vertex_count += lines.draw_line(float3(a, 0), float3(b, 0), eq.col);
 					
-					cursor_select_line(eq_i, float2(prev_x,prev_y), float2(plot_x,plot_y));
+					cursor_select_line(eq_i, a, b);
 				}
-
-				prev_x = plot_x;
-				prev_y = plot_y;
 			}
 		}
 
@@ -615,6 +669,20 @@ struct App : public IApp {
 			std::string str = eq.def.name.empty() ? "" : eq.def.name + "() : ";
 			str.append( format_point(coord.x, coord.y) );
 
+			// exact slope from the derivative of the function, in the units of the axes
+			// on log axes that is the slope of the plotted line: d(log10 y)/dx = dy/dx / (y ln10), dy/d(log10 x) = dy/dx * x ln10 (x/y on log-log)
+			if (auto* slope = equations.slope_code(nearest_eq)) {
+				float x = log_x ? powf(10.0f, coord.x) : coord.x;
+				float y = log_y ? powf(10.0f, coord.y) : coord.y;
+				float ln10 = logf(10.0f);
+				float dydx;
+				if (!eval.execute(*slope, x, &dydx)) {
+					if (log_x) dydx *= x * ln10;
+					if (log_y) dydx /= y * ln10;
+					str.append( prints(" slope: %.3f", dydx * axes[0].units->scale / axes[1].units->scale) );
+				}
+			}
+
 			float2 pos = cursor * px2world + view0;
 			text.draw_text(str, text_size, float4(0.98f,0.98f,0.98f,1),
 				map_text(float3(pos, 0), view), 0, ticks_px * 1.8f);
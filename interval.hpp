@@ -0,0 +1,282 @@
+#pragma once
+#include "common.hpp"
+#include "vecmath.hpp"
+
+/*
+	Interval arithmetic, used by the interval versions of the std_functions and Evaluator::execute_interval
+
+	An Interval bounds all values an expression can take while its inputs vary over their intervals.
+	Undefined results (NaN) are tracked separately from the bounds of the defined ones:
+	  lo <= hi      all defined values are in [lo, hi] (bounds may be infinite)
+	  lo >  hi      there are no defined values
+	  undef         some values may be undefined, this can not be told from lo, hi since NaN would break all comparisons
+
+	+ - * / need no widening, since rounding to nearest is monotonic, so rounding the results at the bounds
+	bounds the rounded results of all inputs.
+	All other functions are widened by a few ulp (see ival_widen), since the evaluators use different implementations
+	(libm, vecmath.hpp polynomials, the jit) which may be off from the libm results by that much.
+*/
+struct Interval {
+	float lo, hi;
+	bool  undef = false;
+
+	Interval () {}
+	explicit Interval (float value): lo{value}, hi{value}, undef{value != value} {
+		if (undef) {
+			lo = +INF;
+			hi = -INF;
+		}
+	}
+	Interval (float lo, float hi, bool undef=false): lo{lo}, hi{hi}, undef{undef} {}
+
+	bool empty () const { return !(lo <= hi); }
+
+	static Interval all () { return { -INF, +INF, true }; }
+	static Interval none () { return { +INF, -INF, true }; }
+};
+
+// sets undef for results of inf - inf, 0 * inf etc. which become NaN at a bound
+inline Interval ival_fix_nan (Interval r) {
+	if (r.lo != r.lo) { r.lo = -INF; r.undef = true; }
+	if (r.hi != r.hi) { r.hi = +INF; r.undef = true; }
+	return r;
+}
+
+// widen outwards by ulps units in the last place (of the larger finite bound) and by abs_err
+inline Interval ival_widen (Interval r, float ulps, float abs_err=0.0f) {
+	if (r.empty()) return r;
+	float big = 0.0f;
+	if (fabsf(r.lo) < INF) big = fabsf(r.lo);
+	if (fabsf(r.hi) < INF) big = max(big, fabsf(r.hi));
+	float err = big * ulps * (1.0f / 8388608.0f) + abs_err; // 2^-23
+	r.lo -= err;
+	r.hi += err;
+	return r;
+}
+
+inline Interval operator- (Interval a) {
+	return { -a.hi, -a.lo, a.undef };
+}
+
+inline Interval operator+ (Interval a, Interval b) {
+	if (a.empty() || b.empty()) return Interval::none();
+	return ival_fix_nan({ a.lo + b.lo, a.hi + b.hi, a.undef || b.undef });
+}
+inline Interval operator- (Interval a, Interval b) {
+	if (a.empty() || b.empty()) return Interval::none();
+	return ival_fix_nan({ a.lo - b.hi, a.hi - b.lo, a.undef || b.undef });
+}
+inline Interval operator* (Interval a, Interval b) {
+	if (a.empty() || b.empty()) return Interval::none();
+
+	float p0 = a.lo * b.lo, p1 = a.lo * b.hi, p2 = a.hi * b.lo, p3 = a.hi * b.hi;
+	// 0 * inf at a corner
+	if (p0 != p0 || p1 != p1 || p2 != p2 || p3 != p3)
+		return Interval::all();
+
+	return { min(min(p0, p1), min(p2, p3)), max(max(p0, p1), max(p2, p3)), a.undef || b.undef };
+}
+inline Interval operator/ (Interval a, Interval b) {
+	if (a.empty() || b.empty()) return Interval::none();
+
+	// divisor touches zero: anything can happen (including 0/0)
+	if (b.lo <= 0.0f && b.hi >= 0.0f)
+		return Interval::all();
+
+	float p0 = a.lo / b.lo, p1 = a.lo / b.hi, p2 = a.hi / b.lo, p3 = a.hi / b.hi;
+	// inf / inf at a corner
+	if (p0 != p0 || p1 != p1 || p2 != p2 || p3 != p3)
+		return Interval::all();
+
+	return { min(min(p0, p1), min(p2, p3)), max(max(p0, p1), max(p2, p3)), a.undef || b.undef };
+}
+
+// union of the values of both intervals
+inline Interval ival_hull (Interval a, Interval b) {
+	return { min(a.lo, b.lo), max(a.hi, b.hi), a.undef || b.undef };
+}
+
+inline Interval ival_pow (Interval a, Interval b) {
+	if (a.empty() || b.empty()) return Interval::none();
+	bool undef = a.undef || b.undef;
+
+	Interval r;
+	if (b.lo == b.hi && b.lo == floorf(b.lo)) {
+		// integer exponent, defined for negative bases too
+		float n = b.lo;
+		bool even = fmodf(n, 2.0f) == 0.0f;
+
+		if (n == 0.0f)
+			return { 1.0f, 1.0f, undef };
+
+		float plo = powf(a.lo, n), phi = powf(a.hi, n);
+		if (a.lo <= 0.0f && a.hi >= 0.0f) {
+			if (n < 0.0f) return Interval::all(); // pole at 0
+			// even powers have their minimum at 0
+			r = even ? Interval(0.0f, max(plo, phi)) : Interval(plo, phi);
+		}
+		else {
+			// monotonic on either side of 0
+			r = Interval(min(plo, phi), max(plo, phi));
+		}
+	}
+	else {
+		// non-integer exponents are only defined for a >= 0 (except for integers inside of b, which we don't bother finding)
+		if (a.lo < 0.0f && b.lo != b.hi)
+			return Interval::all();
+		if (a.lo < 0.0f)
+			undef = true;
+		if (a.hi < 0.0f)
+			return Interval::none();
+
+		// a^b for a >= 0 is monotonic in a and b, so the extremes are at the corners
+		float alo = max(a.lo, 0.0f);
+		float p0 = powf(alo, b.lo), p1 = powf(alo, b.hi), p2 = powf(a.hi, b.lo), p3 = powf(a.hi, b.hi);
+		r = Interval(min(min(p0, p1), min(p2, p3)), max(max(p0, p1), max(p2, p3)));
+	}
+
+	r.undef = undef;
+	r = ival_fix_nan(r);
+
+	// vpow computes exp(b*log(a)), which gets less exact as |b*log(a)| = |log(result)| grows, so widen each bound by its own error
+	auto err = [] (float y) {
+		y = fabsf(y);
+		return y > 0.0f && y < INF ? y * (8.0f + 2.0f * fabsf(logf(y))) * (1.0f / 8388608.0f) : 0.0f;
+	};
+	if (!r.empty()) {
+		r.lo -= err(r.lo);
+		r.hi += err(r.hi);
+	}
+	return r;
+}
+
+inline Interval ival_sqrt (Interval a) {
+	if (a.empty() || a.hi < 0.0f) return Interval::none();
+	// sqrt is correctly rounded, so it's monotonic after rounding too
+	return { sqrtf(max(a.lo, 0.0f)), sqrtf(a.hi), a.undef || a.lo < 0.0f };
+}
+inline Interval ival_ln (Interval a) {
+	if (a.empty() || a.hi < 0.0f) return Interval::none();
+	// ln(0) = -inf
+	return ival_widen(Interval(logf(max(a.lo, 0.0f)), logf(a.hi), a.undef || a.lo < 0.0f), 2.0f);
+}
+inline Interval ival_abs (Interval a) {
+	if (a.empty()) return a;
+	if (a.lo >= 0.0f) return a;
+	if (a.hi <= 0.0f) return -a;
+	return { 0.0f, max(-a.lo, a.hi), a.undef };
+}
+
+// monotonic functions can just be applied to the bounds
+template <typename FUNC>
+inline Interval ival_monotonic (Interval a, FUNC func) {
+	if (a.empty()) return a;
+	return ival_fix_nan({ func(a.lo), func(a.hi), a.undef });
+}
+
+inline Interval ival_min (Interval a, Interval b) {
+	if (a.empty() || b.empty()) return Interval::none();
+	return { min(a.lo, b.lo), min(a.hi, b.hi), a.undef || b.undef };
+}
+inline Interval ival_max (Interval a, Interval b) {
+	if (a.empty() || b.empty()) return Interval::none();
+	return { max(a.lo, b.lo), max(a.hi, b.hi), a.undef || b.undef };
+}
+
+inline Interval ival_mod (Interval a, Interval b) {
+	if (a.empty() || b.empty()) return Interval::none();
+	if (a.lo == -INF || a.hi == INF || (b.lo <= 0.0f && b.hi >= 0.0f)) {
+		// fmod(inf, b) and fmod(a, 0) are NaN, the defined results are still within (-|b|, |b|)
+		float bmax = max(fabsf(b.lo), fabsf(b.hi));
+		return { -bmax, bmax, true };
+	}
+
+	bool undef = a.undef || b.undef;
+	if (b.lo == b.hi) {
+		// a range within one period of b is mapped monotonically
+		float p = b.lo;
+		if (floorf(a.lo / p) == floorf(a.hi / p)) {
+			float lo = mymod(a.lo, p), hi = mymod(a.hi, p);
+			if (lo <= hi)
+				return { lo, hi, undef };
+		}
+	}
+
+	// the result has the sign of b and is at most |b|
+	return b.lo > 0.0f ? Interval(0.0f, b.hi, undef) : Interval(b.lo, 0.0f, undef);
+}
+
+// sin over an interval of radians
+// extremes are at the bounds or at the peaks (pi/2 + 2pi*k) and troughs (-pi/2 + 2pi*k) inside of the interval
+inline Interval ival_sin (Interval a) {
+	if (a.empty()) return a;
+	if (a.lo == -INF || a.hi == INF) // sin(inf) is NaN
+		return { -1.0f, 1.0f, true };
+
+	const double PI2 = 6.283185307179586;
+	double lo = a.lo, hi = a.hi;
+	if (hi - lo >= PI2)
+		return { -1.0f, 1.0f, a.undef };
+
+	float slo = sinf(a.lo), shi = sinf(a.hi);
+	Interval r = { min(slo, shi), max(slo, shi), a.undef };
+
+	// first peak/trough at or after lo
+	if (ceil((lo - PI2*0.25) / PI2) * PI2 + PI2*0.25 <= hi) r.hi = 1.0f;
+	if (ceil((lo + PI2*0.25) / PI2) * PI2 - PI2*0.25 <= hi) r.lo = -1.0f;
+
+	// the vecmath.hpp polynomials are only exact to an absolute error for larger arguments (see there)
+	r = ival_widen(r, 4.0f, 1.5e-7f);
+	r.lo = max(r.lo, -1.0f - 1e-6f);
+	r.hi = min(r.hi, +1.0f + 1e-6f);
+	return r;
+}
+inline Interval ival_cos (Interval a) {
+	if (a.empty()) return a;
+	if (a.lo == -INF || a.hi == INF)
+		return { -1.0f, 1.0f, true };
+
+	const double PI2 = 6.283185307179586;
+	double lo = a.lo, hi = a.hi;
+	if (hi - lo >= PI2)
+		return { -1.0f, 1.0f, a.undef };
+
+	float clo = cosf(a.lo), chi = cosf(a.hi);
+	Interval r = { min(clo, chi), max(clo, chi), a.undef };
+
+	// peaks at 2pi*k, troughs at pi + 2pi*k
+	if (ceil(lo / PI2) * PI2 <= hi)                       r.hi = 1.0f;
+	if (ceil((lo - PI2*0.5) / PI2) * PI2 + PI2*0.5 <= hi) r.lo = -1.0f;
+
+	r = ival_widen(r, 4.0f, 1.5e-7f);
+	r.lo = max(r.lo, -1.0f - 1e-6f);
+	r.hi = min(r.hi, +1.0f + 1e-6f);
+	return r;
+}
+inline Interval ival_tan (Interval a) {
+	if (a.empty()) return a;
+	if (a.lo == -INF || a.hi == INF)
+		return Interval::all();
+
+	// tan is increasing between its poles at pi/2 + pi*k
+	const double PI = 3.141592653589793;
+	if (floor((a.lo - PI*0.5) / PI) != floor((a.hi - PI*0.5) / PI))
+		return Interval::all();
+
+	return ival_widen(ival_monotonic(a, tanf), 4.0f, 1.5e-7f);
+}
+
+inline Interval ival_asin (Interval a) {
+	if (a.empty() || a.lo > 1.0f || a.hi < -1.0f) return Interval::none();
+	Interval r = { asinf(max(a.lo, -1.0f)), asinf(min(a.hi, 1.0f)), a.undef || a.lo < -1.0f || a.hi > 1.0f };
+	return ival_widen(r, 4.0f);
+}
+inline Interval ival_acos (Interval a) {
+	if (a.empty() || a.lo > 1.0f || a.hi < -1.0f) return Interval::none();
+	// decreasing
+	Interval r = { acosf(min(a.hi, 1.0f)), acosf(max(a.lo, -1.0f)), a.undef || a.lo < -1.0f || a.hi > 1.0f };
+	return ival_widen(r, 4.0f);
+}
+inline Interval ival_atan (Interval a) {
+	return ival_widen(ival_monotonic(a, atanf), 4.0f);
+}
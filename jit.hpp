@@ -0,0 +1,662 @@
+#pragma once
+#include "common.hpp"
+#include "execute.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64)
+	#define JIT_X64 1
+#else
+	#define JIT_X64 0
+#endif
+
+#if JIT_X64
+	#ifdef _WIN32
+		#ifndef WIN32_LEAN_AND_MEAN
+			#define WIN32_LEAN_AND_MEAN
+		#endif
+		#ifndef NOMINMAX
+			#define NOMINMAX
+		#endif
+		#include <windows.h>
+	#else
+		#include <sys/mman.h>
+	#endif
+#endif
+
+/*
+	x86-64 JIT for the register code
+
+	Compiles an equation (RegCode, with its user function calls inlined) into a native loop over the samples
+	  void kernel (float const* xs, float* ys, int n)
+	that computes 4 samples per iteration with packed SSE, followed by a scalar loop for the remaining samples.
+	SSE2 is always available on x86-64, so no cpu feature checks are needed.
+
+	Virtual registers map to 16 byte stack slots, the first 12 of which are kept in xmm registers (no real register allocation),
+	which is still much faster than the interpreter since all dispatch and lane array traffic disappears. Constants and variables are read from a 16 byte aligned pool
+	(each value broadcast to 4 floats), variables get updated by bind() each time before running the kernel,
+	so the kernel only needs to be recompiled when the code changes.
+
+	sqrt, abs, min, max, clamp and small constant integer powers are inlined,
+	other std functions and powers are called via jit_call_builtin, which runs their batch version on the slot lanes.
+	Code that can't be compiled (unresolved names, argument count errors, recursion) makes compile() fail,
+	in which case the caller should simply use the interpreter, which then also reports the error.
+*/
+typedef void (*jit_kernel) (float const* xs, float* ys, int n);
+
+// a std function called from jitted code, the kernel passes its frame (stack slots) and the number of lanes (4 or 1)
+struct JitCall {
+	StdFunction const* builtin;
+	DegreeMode         deg_mode; // updated by bind()
+	int                argc;
+	int                first_arg; // slot of first argument
+	int                dst;       // slot of result
+};
+inline void jit_call_builtin (JitCall const* call, float* frame, int count) {
+	float const* args[Evaluator::MAX_REGS];
+	for (int i=0; i<call->argc; ++i)
+		args[i] = frame + (call->first_arg + i) * 4;
+
+	// argument count errors are already caught in compile(), and batch functions have no other errors
+	call->builtin->batch_func(call->deg_mode, call->argc, args, frame + call->dst * 4, count);
+}
+
+// pow as a std function, so that non-constant powers can be called like the other std functions
+inline const char* jit_batch_pow (DegreeMode const& deg, int argc, float const* const* args, float* result, int count) {
+	lanes_pow(result, args[0], args[1], count);
+	return nullptr;
+}
+inline StdFunction const jit_pow_func = { nullptr, false, &jit_batch_pow };
+
+struct JitKernel {
+	jit_kernel kernel = nullptr;
+
+	// executable memory
+	uint8_t* mem = nullptr;
+	size_t   mem_size = 0;
+
+	struct alignas(16) PoolEntry {
+		float v[4];
+	};
+	std::vector<PoolEntry> pool;
+
+	struct PoolVar {
+		int pool_idx;
+		int eq_idx; // equation index of variable
+	};
+	std::vector<PoolVar> pool_vars;
+
+	std::vector<std::unique_ptr<JitCall>> calls;
+
+	JitKernel () {}
+	~JitKernel () { free_mem(); }
+
+	JitKernel (JitKernel&& r) { *this = std::move(r); }
+	JitKernel& operator= (JitKernel&& r) {
+		if (this != &r) {
+			free_mem();
+			kernel    = r.kernel;
+			mem       = r.mem;
+			mem_size  = r.mem_size;
+			pool      = std::move(r.pool);
+			pool_vars = std::move(r.pool_vars);
+			calls     = std::move(r.calls);
+			r.kernel = nullptr;
+			r.mem = nullptr;
+			r.mem_size = 0;
+		}
+		return *this;
+	}
+
+	void free_mem () {
+	#if JIT_X64
+		if (mem) {
+		#ifdef _WIN32
+			VirtualFree(mem, 0, MEM_RELEASE);
+		#else
+			munmap(mem, mem_size);
+		#endif
+		}
+	#endif
+		kernel = nullptr;
+		mem = nullptr;
+		mem_size = 0;
+	}
+
+	// copy the code into executable memory (mapped writable first, then switched to executable, never both)
+	bool finalize (std::vector<uint8_t> const& code) {
+		free_mem();
+	#if JIT_X64
+		size_t size = (code.size() + 4095) & ~(size_t)4095;
+	#ifdef _WIN32
+		void* ptr = VirtualAlloc(nullptr, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+		if (!ptr) return false;
+		mem = (uint8_t*)ptr;
+		mem_size = size;
+
+		memcpy(mem, code.data(), code.size());
+
+		DWORD old_protect;
+		if (!VirtualProtect(mem, size, PAGE_EXECUTE_READ, &old_protect)) { free_mem(); return false; }
+		FlushInstructionCache(GetCurrentProcess(), mem, size);
+	#else
+		void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (ptr == MAP_FAILED) return false;
+		mem = (uint8_t*)ptr;
+		mem_size = size;
+
+		memcpy(mem, code.data(), code.size());
+
+		if (mprotect(mem, size, PROT_READ | PROT_EXEC) != 0) { free_mem(); return false; }
+	#endif
+		kernel = (jit_kernel)mem;
+		return true;
+	#else
+		return false;
+	#endif
+	}
+
+	bool compile (RegCode const& code, Evaluator const& eval);
+
+	// update variable values and degree mode, returns false if a variable is invalid (the interpreter will report the error)
+	bool bind (Evaluator const& eval) {
+		for (auto& var : pool_vars) {
+			auto& val = eval.var_values[var.eq_idx];
+			if (!val.valid)
+				return false;
+			for (int i=0; i<4; ++i)
+				pool[var.pool_idx].v[i] = val.value;
+		}
+		for (auto& call : calls)
+			call->deg_mode = eval.deg_mode;
+		return true;
+	}
+
+	void run (float const* xs, float* ys, int n) {
+		assert(kernel);
+		assert(n >= 0);
+		kernel(xs, ys, n);
+	}
+};
+
+#if JIT_X64
+// Minimal x86-64 machine code emitter, only the handful of instructions the kernels use
+// Fixed register usage (all gp registers are volatile in both the SysV and Win64 ABI):
+//   r9 = xs   r10 = ys   r11d = remaining n   rax = pool
+//   rsp = stack slots (16 byte aligned, slot i at rsp + i*16)   xmm0-xmm2 scratch   xmm4-xmm15 first 12 slots
+struct JitCompiler {
+	std::vector<uint8_t> out;
+
+	JitKernel&       jit;
+	Evaluator const& eval;
+
+	std::unordered_map<uint32_t, int> pool_consts;
+	std::unordered_map<int, int>      pool_var_map;
+
+	static constexpr int POOL_SIGN = 0;
+	static constexpr int POOL_ABS  = 1;
+	static constexpr int POOL_ONE  = 2;
+
+	static constexpr int MAX_INLINE_DEPTH = 16;
+
+	// where a register operand lives
+	struct Mem {
+		bool pool; // rax-relative pool entry, else rsp-relative slot
+		int  idx;
+	};
+
+	void byte (uint8_t b) { out.push_back(b); }
+	void bytes (std::initializer_list<uint8_t> bs) { out.insert(out.end(), bs); }
+	void imm32 (uint32_t v) { for (int i=0; i<4; ++i) byte((uint8_t)(v >> (i*8))); }
+	void imm64 (uint64_t v) { for (int i=0; i<8; ++i) byte((uint8_t)(v >> (i*8))); }
+
+	int add_pool (float value) {
+		uint32_t bits;
+		memcpy(&bits, &value, sizeof(float));
+
+		auto res = pool_consts.emplace(bits, (int)jit.pool.size());
+		if (res.second)
+			jit.pool.push_back({{ value, value, value, value }});
+		return res.first->second;
+	}
+	int add_pool_bits (uint32_t bits) {
+		float f;
+		memcpy(&f, &bits, sizeof(float));
+		return add_pool(f);
+	}
+	int add_pool_var (int eq_idx) {
+		auto res = pool_var_map.emplace(eq_idx, (int)jit.pool.size());
+		if (res.second) {
+			jit.pool.push_back({});
+			jit.pool_vars.push_back({ (int)jit.pool.size()-1, eq_idx });
+		}
+		return res.first->second;
+	}
+
+	// sse instruction xmm<reg>, [mem]   (packed: no prefix  scalar: F3 prefix for the ss variant)
+	void sse_mem (uint8_t prefix, uint8_t opcode, int reg, Mem m) {
+		if (prefix) byte(prefix);
+		if (reg >= 8) byte(0x44); // REX.R
+		bytes({ 0x0F, opcode });
+		if (m.pool) {
+			byte((uint8_t)(0x80 | ((reg & 7) << 3) | 0)); // [rax + disp32]
+		} else {
+			byte((uint8_t)(0x80 | ((reg & 7) << 3) | 4)); // [rsp + disp32]
+			byte(0x24);
+		}
+		imm32((uint32_t)(m.idx * 16));
+	}
+	// sse instruction xmm<dst>, xmm<src>
+	void sse_reg (uint8_t prefix, uint8_t opcode, int dst, int src) {
+		if (prefix) byte(prefix);
+		if (dst >= 8 || src >= 8) byte((uint8_t)(0x40 | (dst >= 8 ? 4 : 0) | (src >= 8 ? 1 : 0))); // REX.R REX.B
+		bytes({ 0x0F, opcode, (uint8_t)(0xC0 | ((dst & 7) << 3) | (src & 7)) });
+	}
+
+	enum SSEOp : uint8_t {
+		SSE_LOAD  = 0x10, // movups / movss
+		SSE_STORE = 0x11,
+		SSE_SQRT  = 0x51,
+		SSE_AND   = 0x54, // andps only, always packed
+		SSE_XOR   = 0x57, // xorps only, always packed
+		SSE_ADD   = 0x58,
+		SSE_MUL   = 0x59,
+		SSE_SUB   = 0x5C,
+		SSE_MIN   = 0x5D,
+		SSE_DIV   = 0x5E,
+		SSE_MAX   = 0x5F,
+		SSE_MOVAPS= 0x28, // register to register only
+	};
+
+	// the first slots live in xmm4-xmm15 instead of memory
+	// (they are spilled to their stack slots around calls to std functions, which read and write the slots in memory)
+	static constexpr int REG_SLOTS = 12;
+	static constexpr int REG_SLOT_XMM = 4;
+
+	// stack slots, plus space to save xmm6-xmm15 on win64
+	static constexpr int FRAME_SLOTS = Evaluator::MAX_REGS + 10;
+
+	static bool in_xmm (Mem m) { return !m.pool && m.idx < REG_SLOTS; }
+
+	// the currently compiled loop body is either packed (4 lanes) or scalar (1 lane)
+	bool packed;
+
+	// which operand xmm0 still holds, to skip reloading a value that was just stored
+	// (most ops consume the result of the previous op)
+	bool xmm0_valid = false;
+	Mem  xmm0_holds;
+
+	void op_mem (SSEOp op, int reg, Mem m) {
+		bool same = xmm0_valid && xmm0_holds.pool == m.pool && xmm0_holds.idx == m.idx;
+		if (op == SSE_LOAD && reg == 0 && same)
+			return;
+
+		bool packed_only = op == SSE_AND || op == SSE_XOR;
+		uint8_t prefix = packed || packed_only ? 0 : 0xF3;
+
+		if (in_xmm(m)) {
+			int xmm = REG_SLOT_XMM + m.idx;
+			if      (op == SSE_LOAD ) sse_reg(0, SSE_MOVAPS, reg, xmm);
+			else if (op == SSE_STORE) sse_reg(0, SSE_MOVAPS, xmm, reg);
+			else                      sse_reg(prefix, op, reg, xmm);
+		} else {
+			sse_mem(prefix, op, reg, m);
+		}
+
+		if (reg == 0) {
+			xmm0_valid = op == SSE_LOAD || op == SSE_STORE;
+			xmm0_holds = m;
+		} else if (op == SSE_STORE && same) {
+			xmm0_valid = false;
+		}
+	}
+	void op_reg (SSEOp op, int dst, int src) {
+		bool packed_only = op == SSE_MOVAPS;
+		sse_reg(packed || packed_only ? 0 : 0xF3, op, dst, src);
+
+		if (dst == 0)
+			xmm0_valid = false;
+	}
+
+	void spill_reg_slots (bool reload) {
+		for (int i=0; i<REG_SLOTS; ++i)
+			sse_mem(0, reload ? SSE_LOAD : SSE_STORE, REG_SLOT_XMM + i, { false, i });
+	}
+
+	Mem operand (RegCode const& code, int base, int reg) {
+		if (reg >= code.argc && reg < code.argc + (int)code.consts.size())
+			return { true, add_pool(code.consts[reg - code.argc]) };
+		return { false, base + reg };
+	}
+
+	bool is_const (RegCode const& code, int reg, float* value) {
+		if (reg >= code.argc && reg < code.argc + (int)code.consts.size()) {
+			*value = code.consts[reg - code.argc];
+			return true;
+		}
+		return false;
+	}
+
+	// calls jit_call_builtin(call, frame, count), saving our volatile registers around it
+	void emit_call (JitCall* call) {
+		bytes({ 0x41, 0x51,  0x41, 0x52,  0x41, 0x53,  0x50 }); // push r9, r10, r11, rax
+		bytes({ 0x48, 0x83, 0xEC, 0x20 }); // sub rsp, 32  (win64 shadow space, keeps rsp 16 byte aligned)
+	#ifdef _WIN32
+		bytes({ 0x48, 0xB9 }); imm64((uint64_t)call);       // mov rcx, call
+		bytes({ 0x48, 0x8D, 0x54, 0x24, 0x40 });            // lea rdx, [rsp + 64]
+		bytes({ 0x41, 0xB8 }); imm32(packed ? 4 : 1);       // mov r8d, count
+	#else
+		bytes({ 0x48, 0xBF }); imm64((uint64_t)call);       // mov rdi, call
+		bytes({ 0x48, 0x8D, 0x74, 0x24, 0x40 });            // lea rsi, [rsp + 64]
+		byte(0xBA); imm32(packed ? 4 : 1);                  // mov edx, count
+	#endif
+		bytes({ 0x48, 0xB8 }); imm64((uint64_t)&jit_call_builtin); // mov rax, jit_call_builtin
+		bytes({ 0xFF, 0xD0 });                              // call rax
+		bytes({ 0x48, 0x83, 0xC4, 0x20 });                  // add rsp, 32
+		bytes({ 0x58,  0x41, 0x5B,  0x41, 0x5A,  0x41, 0x59 }); // pop rax, r11, r10, r9
+	}
+
+	void emit_batch_call (StdFunction const* builtin, int argc, int first_arg, int dst) {
+		auto call = std::make_unique<JitCall>();
+		call->builtin   = builtin;
+		call->deg_mode  = eval.deg_mode;
+		call->argc      = argc;
+		call->first_arg = first_arg;
+		call->dst       = dst;
+
+		spill_reg_slots(false);
+		emit_call(call.get());
+		spill_reg_slots(true);
+		xmm0_valid = false;
+
+		jit.calls.push_back(std::move(call));
+	}
+
+	bool emit_builtin (RegCode const& code, int base, RegOp const& op) {
+		auto* builtin = op.builtin;
+
+		// check argument count by dry running the batch function with zero lanes
+		float const* dummy_args[Evaluator::MAX_REGS] = {};
+		if (builtin->batch_func(eval.deg_mode, op.argc, dummy_args, nullptr, 0))
+			return false;
+
+		Mem dst = { false, base + op.dst };
+		auto arg = [&] (int i) { return Mem{ false, base + op.a + i }; };
+
+		auto func = builtin->func_ptr;
+		if (func == (void*)&exec_sqrt) {
+			op_mem(SSE_SQRT, 0, arg(0));
+		}
+		else if (func == (void*)&exec_abs) {
+			op_mem(SSE_LOAD, 0, arg(0));
+			op_mem(SSE_AND, 0, { true, POOL_ABS });
+		}
+		else if (func == (void*)&exec_min || func == (void*)&exec_max) {
+			// same operand order as vmin/vmax, so nan handling matches the batch evaluator
+			SSEOp sse = func == (void*)&exec_min ? SSE_MIN : SSE_MAX;
+			op_mem(SSE_LOAD, 0, arg(0));
+			for (int i=1; i<op.argc; ++i)
+				op_mem(sse, 0, arg(i));
+		}
+		else if (func == (void*)&exec_clamp) {
+			op_mem(SSE_LOAD, 0, arg(0));
+			op_mem(SSE_MAX, 0, arg(1));
+			op_mem(SSE_MIN, 0, arg(2));
+		}
+		else {
+			emit_batch_call(builtin, op.argc, base + op.a, base + op.dst);
+			return true;
+		}
+
+		op_mem(SSE_STORE, 0, dst);
+		return true;
+	}
+
+	bool emit_pow (RegCode const& code, int base, RegOp const& op) {
+		// small constant integer powers are inlined, with the same square-and-multiply as lanes_pow so results match exactly
+		float b;
+		if (!is_const(code, op.b, &b) || !(b >= -8.0f && b <= 8.0f && b == (float)(int)b)) {
+			// else call lanes_pow with the operands copied to the two free slots above the frame
+			int tmp = base + code.reg_count;
+			if (tmp + 2 > Evaluator::MAX_REGS)
+				return false;
+
+			op_mem(SSE_LOAD, 0, operand(code, base, op.a));
+			op_mem(SSE_STORE, 0, { false, tmp });
+			op_mem(SSE_LOAD, 0, operand(code, base, op.b));
+			op_mem(SSE_STORE, 0, { false, tmp+1 });
+
+			emit_batch_call(&jit_pow_func, 2, tmp, base + op.dst);
+			return true;
+		}
+		int n = (int)b;
+
+		op_mem(SSE_LOAD, 0, operand(code, base, op.a)); // base
+		op_mem(SSE_LOAD, 1, { true, POOL_ONE });        // res
+		for (int e = n < 0 ? -n : n; e; e >>= 1) {
+			if (e & 1) op_reg(SSE_MUL, 1, 0);
+			if (e > 1) op_reg(SSE_MUL, 0, 0);
+		}
+		if (n < 0) {
+			op_mem(SSE_LOAD, 2, { true, POOL_ONE });
+			op_reg(SSE_DIV, 2, 1);
+			op_reg(SSE_MOVAPS, 1, 2);
+		}
+		op_mem(SSE_STORE, 1, { false, base + op.dst });
+		return true;
+	}
+
+	// emit the ops of code with its frame at slot <base>, inlining user function calls
+	bool emit_code (RegCode const& code, int base, int depth) {
+		if (depth > MAX_INLINE_DEPTH || base + code.reg_count > Evaluator::MAX_REGS)
+			return false;
+
+		for (auto& op : code.ops) {
+			Mem dst = { false, base + op.dst };
+
+			switch (op.code) {
+				case ROP_MOV: {
+					op_mem(SSE_LOAD, 0, operand(code, base, op.a));
+					op_mem(SSE_STORE, 0, dst);
+				} break;
+
+				case ROP_LOAD_VAR: {
+					int eq_idx = code.links[op.index];
+					if (eq_idx < 0) return false;
+
+					op_mem(SSE_LOAD, 0, { true, add_pool_var(eq_idx) });
+					op_mem(SSE_STORE, 0, dst);
+				} break;
+
+				case ROP_CALL: {
+					int eq_idx = code.links[op.index];
+					if (eq_idx < 0 || !eval.functions[eq_idx].code) return false;
+
+					RegCode const& callee = *eval.functions[eq_idx].code;
+					if (callee.argc != op.argc) return false;
+
+					if (!emit_code(callee, base + op.a, depth+1)) return false;
+
+					op_mem(SSE_LOAD, 0, operand(callee, base + op.a, callee.result));
+					op_mem(SSE_STORE, 0, dst);
+				} break;
+
+				case ROP_BUILTIN: {
+					if (!emit_builtin(code, base, op)) return false;
+				} break;
+
+				case ROP_ADD      :
+				case ROP_SUBSTRACT:
+				case ROP_MULTIPLY :
+				case ROP_DIVIDE   : {
+					SSEOp sse;
+					switch (op.code) {
+						case ROP_ADD      : sse = SSE_ADD; break;
+						case ROP_SUBSTRACT: sse = SSE_SUB; break;
+						case ROP_MULTIPLY : sse = SSE_MUL; break;
+						default           : sse = SSE_DIV; break;
+					}
+					op_mem(SSE_LOAD, 0, operand(code, base, op.a));
+					op_mem(sse, 0, operand(code, base, op.b));
+					op_mem(SSE_STORE, 0, dst);
+				} break;
+
+				case ROP_POW: {
+					if (!emit_pow(code, base, op)) return false;
+				} break;
+
+				case ROP_NEGATE: {
+					op_mem(SSE_LOAD, 0, operand(code, base, op.a));
+					op_mem(SSE_XOR, 0, { true, POOL_SIGN });
+					op_mem(SSE_STORE, 0, dst);
+				} break;
+
+				case ROP_RETURN: {
+					return true;
+				}
+
+				default:
+					return false;
+			}
+		}
+		return true;
+	}
+
+	// loop body for one iteration (4 or 1 samples)
+	bool emit_body (RegCode const& code) {
+		xmm0_valid = false;
+
+		if (code.argc == 1) {
+			if (!packed) byte(0xF3);
+			bytes({ 0x41, 0x0F, 0x10, 0x01 });       // movups/movss xmm0, [r9]
+			op_mem(SSE_STORE, 0, { false, 0 });
+		}
+
+		if (!emit_code(code, 0, 0))
+			return false;
+
+		op_mem(SSE_LOAD, 0, operand(code, 0, code.result));
+		if (!packed) byte(0xF3);
+		bytes({ 0x41, 0x0F, 0x11, 0x02 });           // movups/movss [r10], xmm0
+		return true;
+	}
+
+	enum Cond : uint8_t {
+		JZ  = 0x84,
+		JNZ = 0x85,
+		JL  = 0x8C,
+		JGE = 0x8D,
+		JLE = 0x8E,
+	};
+	// conditional jump to an already emitted target
+	void jcc (Cond cond, size_t target) {
+		bytes({ 0x0F, cond });
+		imm32((uint32_t)((int64_t)target - (int64_t)(out.size() + 4)));
+	}
+	// conditional jump forward, returns location of the rel32 to patch once the target is known
+	size_t jcc_fwd (Cond cond) {
+		bytes({ 0x0F, cond });
+		imm32(0);
+		return out.size() - 4;
+	}
+	void patch_here (size_t at) {
+		uint32_t rel = (uint32_t)((int64_t)out.size() - (int64_t)(at + 4));
+		memcpy(&out[at], &rel, 4);
+	}
+
+	bool compile (RegCode const& code) {
+		if (code.argc > 1)
+			return false;
+
+		add_pool_bits(0x80000000u); // POOL_SIGN
+		add_pool_bits(0x7fffffffu); // POOL_ABS
+		add_pool(1.0f);             // POOL_ONE
+
+		// prologue, move args into the registers shared by both ABIs
+	#ifdef _WIN32
+		bytes({ 0x49, 0x89, 0xC9 }); // mov r9, rcx
+		bytes({ 0x49, 0x89, 0xD2 }); // mov r10, rdx
+		bytes({ 0x45, 0x89, 0xC3 }); // mov r11d, r8d
+	#else
+		bytes({ 0x49, 0x89, 0xF9 }); // mov r9, rdi
+		bytes({ 0x49, 0x89, 0xF2 }); // mov r10, rsi
+		bytes({ 0x41, 0x89, 0xD3 }); // mov r11d, edx
+	#endif
+		byte(0x55);                                      // push rbp
+		bytes({ 0x48, 0x89, 0xE5 });                     // mov rbp, rsp
+		bytes({ 0x48, 0x83, 0xE4, 0xF0 });               // and rsp, -16
+		bytes({ 0x48, 0x81, 0xEC }); imm32(FRAME_SLOTS * 16); // sub rsp, slots
+	#ifdef _WIN32
+		// xmm6-xmm15 are callee-saved on win64
+		for (int i=6; i<16; ++i)
+			sse_mem(0, SSE_STORE, i, { false, Evaluator::MAX_REGS + i-6 });
+	#endif
+
+		// pool address is patched in at the end, since the pool vector is still growing while the body is emitted
+		bytes({ 0x48, 0xB8 });                           // mov rax, pool
+		size_t pool_addr = out.size();
+		imm64(0);
+
+		// packed loop, 4 samples per iteration
+		bytes({ 0x41, 0x83, 0xFB, 0x04 });               // cmp r11d, 4
+		size_t jl_tail = jcc_fwd(JL);
+
+		size_t loop4 = out.size();
+		packed = true;
+		if (!emit_body(code)) return false;
+
+		bytes({ 0x49, 0x83, 0xC1, 0x10 });               // add r9, 16
+		bytes({ 0x49, 0x83, 0xC2, 0x10 });               // add r10, 16
+		bytes({ 0x41, 0x83, 0xEB, 0x04 });               // sub r11d, 4
+		bytes({ 0x41, 0x83, 0xFB, 0x04 });               // cmp r11d, 4
+		jcc(JGE, loop4);
+
+		// scalar loop for the remaining samples
+		patch_here(jl_tail);
+		bytes({ 0x45, 0x85, 0xDB });                     // test r11d, r11d
+		size_t jle_done = jcc_fwd(JLE);                   // counter is signed, n <= 0 does nothing
+
+		size_t loop1 = out.size();
+		packed = false;
+		if (!emit_body(code)) return false;
+
+		bytes({ 0x49, 0x83, 0xC1, 0x04 });               // add r9, 4
+		bytes({ 0x49, 0x83, 0xC2, 0x04 });               // add r10, 4
+		bytes({ 0x41, 0x83, 0xEB, 0x01 });               // sub r11d, 1
+		jcc(JNZ, loop1);
+
+		// epilogue
+		patch_here(jle_done);
+	#ifdef _WIN32
+		for (int i=6; i<16; ++i)
+			sse_mem(0, SSE_LOAD, i, { false, Evaluator::MAX_REGS + i-6 });
+	#endif
+		bytes({ 0x48, 0x89, 0xEC });                     // mov rsp, rbp
+		byte(0x5D);                                      // pop rbp
+		byte(0xC3);                                      // ret
+
+		uint64_t pool_ptr = (uint64_t)jit.pool.data();
+		memcpy(&out[pool_addr], &pool_ptr, 8);
+
+		return jit.finalize(out);
+	}
+};
+
+inline bool JitKernel::compile (RegCode const& code, Evaluator const& eval) {
+	ZoneScoped;
+
+	free_mem();
+	pool.clear();
+	pool_vars.clear();
+	calls.clear();
+
+	JitCompiler c = { {}, *this, eval };
+	if (!c.compile(code)) {
+		free_mem();
+		return false;
+	}
+	return true;
+}
+#else
+inline bool JitKernel::compile (RegCode const& code, Evaluator const& eval) {
+	return false;
+}
+#endif
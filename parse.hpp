@@ -5,8 +5,10 @@
 enum OPType {
 	OP_VALUE,        // push value
 	OP_VARIABLE,     // push vars.lookup(varname)
+	OP_ARGUMENT,     // push function argument    (OP_VARIABLE resolved by resolve_locals)
 
 	OP_FUNCCALL,     // push <argc> arguments, call function
+	OP_BUILTIN,      // push <argc> arguments, call std function (OP_FUNCCALL resolved by resolve_locals)
 
 	OP_ADD,          // pop a, pop b, push a+b
 	OP_SUBSTRACT,    // pop a, pop b, push a-b
@@ -15,12 +17,17 @@ enum OPType {
 	OP_POW,          // pop a, pop b, push a^b
 
 	OP_UNARY_NEGATE, // pop a,        push -a
+
+	OP_LOAD_TEMP,    // push temp <index>          (common subexpressions, see CSE in codegen.hpp)
+	OP_DROP_TEMPS,   // pop a, pop <argc> temps, push a
 };
 inline constexpr const char* OPType_str[] = {
 	"OP_VALUE",
 	"OP_VARIABLE",
+	"OP_ARGUMENT",
 
 	"OP_FUNCCALL",
+	"OP_BUILTIN",
 
 	"OP_ADD",
 	"OP_SUBSTRACT",
@@ -29,6 +36,9 @@ inline constexpr const char* OPType_str[] = {
 	"OP_POW",
 
 	"OP_UNARY_NEGATE",
+
+	"OP_LOAD_TEMP",
+	"OP_DROP_TEMPS",
 };
 
 inline constexpr bool is_binary_op (TokenType tok) {
@@ -64,6 +74,8 @@ inline int get_binary_op_associativity (TokenType tok) {
 	return (bool)BINARY_OP_ASSOCIATIVITY[tok - T_PLUS];
 }
 
+struct StdFunction;
+
 struct Operation {
 	OPType           code;
 
@@ -72,21 +84,41 @@ struct Operation {
 		int          argc;
 	};
 
+	// resolved name, so the interpreter never has to look up text
+	union {
+		int                index;   // OP_ARGUMENT: argument position
+		                            // OP_LOAD_TEMP: temp number
+		                            // OP_VARIABLE, OP_FUNCCALL: index of referenced equation, -1 if unresolved (linked in Equations::dependency_sort)
+		StdFunction const* builtin; // OP_BUILTIN
+	};
+
 	std::string_view text;
+	Symbol           sym; // interned text of OP_VARIABLE, OP_FUNCCALL (including the primes of derivatives) and OP_ARGUMENT
 };
 
 struct ASTNode;
 
-#define BUMP_ALLOCATOR 0
+// ast nodes live in an arena per equation, so parsing doesn't malloc every node
+// and trees never get destroyed node by node (which recursed down long next chains)
+#define BUMP_ALLOCATOR 1
 #if BUMP_ALLOCATOR
 typedef ASTNode* ast_ptr;
 
+// blocks grow from MIN_BLOCK_SIZE to BLOCK_SIZE, so the many small equations of a large workspace don't each take a full block
+// reset() frees all items at once but keeps the blocks, so reparsing or respecializing an equation reuses them
 struct BlockBumpAllocator {
 	char* next = nullptr;
 	char* end  = nullptr;
 
+	static constexpr size_t MIN_BLOCK_SIZE = 1 * KB;
 	static constexpr size_t BLOCK_SIZE = 16 * KB;
-	std::vector<char*> blocks;
+
+	struct Block {
+		char*  data;
+		size_t size;
+	};
+	std::vector<Block> blocks;
+	size_t cur_block = 0; // index of the block next points into
 
 	// note: no T::ctor will be called!
 	// use placement new yourself if needed
@@ -98,38 +130,48 @@ struct BlockBumpAllocator {
 			assert(false);
 			return nullptr;
 		}
-		// go to next block if item does not fit onto current block
-		if (next + sizeof(T) > end)
-			next = nullptr;
-		if (!next)
-			alloc_block();
-
 		// align next ptr where appropriate
-		next = (char*)align_up((uintptr_t)next, alignof(T));
+		char* item = (char*)align_up((uintptr_t)next, alignof(T));
 
-		// allocate by returning next and incrementing next past end of current item
-		T* item = (T*)next;
-		next += sizeof(T);
+		// go to next block if item does not fit onto current block
+		if (!next || item + sizeof(T) > end) {
+			next_block();
+			item = (char*)align_up((uintptr_t)next, alignof(T));
+		}
 
-		return item;
+		// allocate by returning next and incrementing next past end of current item
+		next = item + sizeof(T);
+		return (T*)item;
 	}
 
-	void alloc_block () {
-		auto* block = new char[BLOCK_SIZE];
-		blocks.emplace_back(block);
+	void next_block () {
+		if (next) cur_block++;
+
+		if (cur_block >= blocks.size()) {
+			size_t size = blocks.empty() ? MIN_BLOCK_SIZE : min(blocks.back().size * 2, BLOCK_SIZE);
+			blocks.push_back({ new char[size], size });
+		}
 
-		next = block;
-		end  = block + BLOCK_SIZE;
+		next = blocks[cur_block].data;
+		end  = next + blocks[cur_block].size;
 	}
-	BlockBumpAllocator () {
-		blocks.reserve(32);
-		alloc_block();
+
+	// forget all items, keeping the blocks for reuse
+	void reset () {
+		next = nullptr;
+		end  = nullptr;
+		cur_block = 0;
 	}
+
+	BlockBumpAllocator () {}
 	// BlockBumpAllocator dtor deallocs all allocated items as well
 	~BlockBumpAllocator () {
-		for (auto block : blocks)
-			delete[] block;
+		for (auto& block : blocks)
+			delete[] block.data;
 	}
+
+	BlockBumpAllocator (BlockBumpAllocator const&) = delete;
+	BlockBumpAllocator& operator= (BlockBumpAllocator const&) = delete;
 };
 
 #define GET_AST_PTR(ptr) (ptr)
@@ -148,15 +190,22 @@ struct ASTNode {
 	ast_ptr          child = nullptr; // first child node, following are linked via next pointer
 };
 
-inline bool lookup_constant (std::string_view const& name, float* out) {
+inline bool lookup_constant (Symbol sym, float* out) {
 	static constexpr float PHI = 1.61803398874989484820f; // golden ratio
 
-	if      (name == "pi")  *out = PI;
-	else if (name == "tau") *out = TAU;
-	else if (name == "e")   *out = EULER;
-	else if (name == "phi") *out = PHI;
-	else                    return false;
-	return true;
+	static const struct { Symbol sym; float value; } constants[] = {
+		{ symbols.intern("pi"),  PI    },
+		{ symbols.intern("tau"), TAU   },
+		{ symbols.intern("e"),   EULER },
+		{ symbols.intern("phi"), PHI   },
+	};
+	for (auto& c : constants) {
+		if (c.sym == sym) {
+			*out = c.value;
+			return true;
+		}
+	}
+	return false;
 }
 
 struct EquationDef {
@@ -167,12 +216,17 @@ struct EquationDef {
 	std::string_view                name;
 	std::vector< std::string_view > args;
 
-	std::unordered_map<std::string_view, int> arg_map; // argument name to argument position map
+	Symbol                          sym = NO_SYMBOL; // of name
+	std::vector<Symbol>             arg_syms;        // of args
 
-	void create_arg_map () {
-		for (int i=0; i<(int)args.size(); ++i) {
-			arg_map.emplace(args[i], i);
+	// argument position of a name, -1 if it is not an argument (the first one wins for duplicate names)
+	// functions only have a few arguments, so this beats a hash map
+	int find_arg (Symbol arg) const {
+		for (int i=0; i<(int)arg_syms.size(); ++i) {
+			if (arg_syms[i] == arg)
+				return i;
 		}
+		return -1;
 	}
 };
 
@@ -193,6 +247,19 @@ struct TokenState {
 	}
 };
 
+// also used by the ast optimizer in codegen to create new nodes
+inline ast_ptr alloc_ast_node (BlockBumpAllocator& allocator, OPType opcode) {
+#if BUMP_ALLOCATOR
+	ast_ptr node = allocator.alloc<ASTNode>();
+#else
+	ast_ptr node = ast_ptr(new ASTNode());
+#endif
+	memset(GET_AST_PTR(node), 0, sizeof(ASTNode));
+
+	node->op.code = opcode;
+	return node;
+}
+
 struct Parser {
 	TokenState tok;
 
@@ -200,15 +267,9 @@ struct Parser {
 	BlockBumpAllocator& allocator;
 
 	ast_ptr ast_node (OPType opcode, Token& tok_for_text) {
-	#if BUMP_ALLOCATOR
-		ast_ptr node = allocator.alloc<ASTNode>();
-	#else
-		ast_ptr node = ast_ptr(new ASTNode());
-	#endif
-		memset(GET_AST_PTR(node), 0, sizeof(ASTNode));
-
-		node->op.code = opcode;
+		ast_ptr node = alloc_ast_node(allocator, opcode);
 		node->op.text = (std::string_view)tok_for_text;
+		node->op.sym  = tok_for_text.sym;
 		return node;
 	}
 
@@ -220,7 +281,7 @@ struct Parser {
 	// or a function call                 ex. abs(x+3)
 	// any of these can be preceded by a unary minus  -5.3 or -x
 	ast_ptr atom () {
-		ast_ptr result;
+		ast_ptr result = nullptr;
 		if (tok.eat(T_PAREN_OPEN)) {
 			result = expression(0);
 			if (!result) return nullptr;
@@ -230,10 +291,25 @@ struct Parser {
 				return nullptr;
 			}
 		}
-		else if (tok.peek(0) == T_IDENTIFIER && tok.peek(1) == T_PAREN_OPEN) {
+		else if (tok.peek(0) == T_IDENTIFIER && (tok.peek(1) == T_PAREN_OPEN || tok.peek(1) == T_PRIME)) {
 			// function call
-			result = ast_node(OP_FUNCCALL, tok.get());
-			tok.get(); // T_PAREN_OPEN
+			auto& name = tok.get();
+			result = ast_node(OP_FUNCCALL, name);
+
+			// derivative f'(x), the primes become part of the name (see SymbolTable::derivative)
+			// built from the tokens instead of sliced from the text, so whitespace like f '(x) doesn't end up in the name
+			if (tok.peek() == T_PRIME) {
+				int order = 0;
+				while (tok.eat(T_PRIME))
+					order++;
+				result->op.sym  = symbols.intern(std::string(std::string_view(name)) + std::string(order, '\''));
+				result->op.text = symbols.name(result->op.sym);
+			}
+
+			if (!tok.eat(T_PAREN_OPEN)) {
+				last_err = "syntax error, '(' expected after derivative!";
+				return nullptr;
+			}
 
 			ast_ptr* arg_ptr = &result->child;
 
@@ -272,7 +348,7 @@ struct Parser {
 				value = t.value;
 			}
 			else if (t.type == T_IDENTIFIER) {
-				if (lookup_constant((std::string_view)t, &value)) {
+				if (lookup_constant(t.sym, &value)) {
 					type = OP_VALUE;
 				} else {
 					type = OP_VARIABLE;
@@ -310,6 +386,7 @@ struct Parser {
 			if (is_binary_op(op_tok) && unary_prec >= get_binary_op_precedence(op_tok)) {
 				unary_minus->child = std::move(lhs);
 				lhs = std::move(unary_minus);
+				unary_minus = nullptr;
 			}
 		}
 
@@ -327,6 +404,7 @@ struct Parser {
 			if (unary_minus && unary_prec >= prec) {
 				unary_minus->child = std::move(lhs);
 				lhs = std::move(unary_minus);
+				unary_minus = nullptr;
 			}
 
 			auto op_type = (OPType)(op_tok + (OP_ADD-T_PLUS));
@@ -357,10 +435,13 @@ struct Parser {
 		if (cur_tok.peek() != T_IDENTIFIER) {
 			def->is_variable = false;
 			def->args = {"x"};
+			def->arg_syms = { symbols.intern("x") };
 			return false;
 		}
 
-		def->name = (std::string_view)cur_tok.get();
+		auto& name = cur_tok.get();
+		def->name = (std::string_view)name;
+		def->sym  = name.sym;
 
 		if (cur_tok.eat(T_PAREN_OPEN)) {
 			def->is_variable = false;
@@ -369,7 +450,9 @@ struct Parser {
 				if (cur_tok.peek() != T_IDENTIFIER)
 					return false; // syntax error, expected argument identifier
 
-				def->args.emplace_back( (std::string_view)cur_tok.get() );
+				auto& arg = cur_tok.get();
+				def->args.emplace_back( (std::string_view)arg );
+				def->arg_syms.emplace_back( arg.sym );
 
 				if (cur_tok.eat(T_COMMA)) {
 					continue;
@@ -0,0 +1,134 @@
+#pragma once
+#include "common.hpp"
+#include <list>
+
+/*
+	Tiled cache of sampled y values
+
+	The x axis (in plot space, before log scaling) is split into tiles of TILE_SIZE samples at power of two sample spacings,
+	level l has samples at x = i * 2^l, so tile t of level l covers [t * TILE_SIZE * 2^l, (t+1) * TILE_SIZE * 2^l).
+	Since tiles are fixed in world space, panning only has to evaluate the newly exposed tiles,
+	and zooming out can build tiles from the finer level below (every other sample) if that is still cached.
+
+	Tiles are keyed by the code_stamp of the equation (see Equations::update_code), which is unique per equation and rebuild,
+	so tiles of edited equations are never hit again and simply age out of the LRU pool, which is limited to max_bytes.
+*/
+struct SampleTiles {
+	static constexpr int TILE_SIZE = 256;
+
+	size_t max_bytes = (size_t)64 << 20;
+
+	struct Key {
+		int  code_stamp;
+		int  level;
+		int  tile;
+		bool log_x, log_y;
+
+		bool operator== (Key const& r) const {
+			return code_stamp == r.code_stamp && level == r.level && tile == r.tile && log_x == r.log_x && log_y == r.log_y;
+		}
+	};
+	struct KeyHash {
+		size_t operator() (Key const& k) const {
+			size_t h = (size_t)k.code_stamp * 0x9e3779b97f4a7c15ull;
+			h ^= (size_t)(uint32_t)k.tile + 0x9e3779b9u + (h << 6) + (h >> 2);
+			h ^= (size_t)(k.level * 4 + k.log_x * 2 + k.log_y) + 0x9e3779b9u + (h << 6) + (h >> 2);
+			return h;
+		}
+	};
+
+	struct Tile {
+		Key   key;
+		float ys[TILE_SIZE];
+	};
+	std::list<Tile> lru; // most recently used first
+	std::unordered_map<Key, std::list<Tile>::iterator, KeyHash> map;
+
+	size_t bytes () const { return lru.size() * sizeof(Tile); }
+
+	static float spacing (int level) {
+		return ldexpf(1.0f, level);
+	}
+	// finest level whose sample spacing is at least as fine as res
+	static int level_for (float res) {
+		return (int)floorf(log2f(res));
+	}
+
+	// tile that contains a sample index (rounding down for negative ones)
+	static int tile_of (int sample) {
+		return sample >= 0 ? sample / TILE_SIZE : -((-sample + TILE_SIZE-1) / TILE_SIZE);
+	}
+
+	Tile* find (Key const& key) {
+		auto it = map.find(key);
+		if (it == map.end())
+			return nullptr;
+
+		lru.splice(lru.begin(), lru, it->second); // mark as most recently used
+		return &*it->second;
+	}
+
+	Tile* insert (Key const& key) {
+		while (!lru.empty() && bytes() + sizeof(Tile) > max_bytes) {
+			map.erase(lru.back().key);
+			lru.pop_back();
+		}
+
+		lru.emplace_front();
+		lru.front().key = key;
+		map[key] = lru.begin();
+		return &lru.front();
+	}
+
+	// get the y values of a tile if it is cached or can be built from the finer level, null if it needs to be evaluated (see tile_xs and store)
+	// the pointer is only valid until the next store
+	float const* lookup (Key const& key) {
+		if (auto* tile = find(key))
+			return tile->ys;
+
+		Key fine0 = key, fine1 = key;
+		fine0.level = fine1.level = key.level - 1;
+		fine0.tile = key.tile * 2;
+		fine1.tile = key.tile * 2 + 1;
+
+		auto* a = find(fine0);
+		auto* b = a ? find(fine1) : nullptr;
+		if (!a || !b)
+			return nullptr;
+
+		auto* tile = insert(key);
+		for (int i=0; i<TILE_SIZE/2; ++i) {
+			tile->ys[i]               = a->ys[i*2];
+			tile->ys[i + TILE_SIZE/2] = b->ys[i*2];
+		}
+		return tile->ys;
+	}
+
+	// x values (not in plot space) to evaluate the samples of a tile at
+	// lookup and store are not thread safe, but evaluating tiles between them is, so that misses can be evaluated in parallel
+	static void tile_xs (Key const& key, float* xs) {
+		float res = spacing(key.level);
+		for (int i=0; i<TILE_SIZE; ++i) {
+			float x = ((float)key.tile * TILE_SIZE + (float)i) * res;
+			xs[i] = key.log_x ? powf(10.0f, x) : x;
+		}
+	}
+	// convert evaluated y values to plot space
+	static void to_plot (Key const& key, float* ys) {
+		if (key.log_y) {
+			for (int i=0; i<TILE_SIZE; ++i)
+				ys[i] = log10f(ys[i]);
+		}
+	}
+
+	// cache the evaluated y values (in plot space) of a tile
+	void store (Key const& key, float const* ys) {
+		auto* tile = insert(key);
+		memcpy(tile->ys, ys, sizeof(tile->ys));
+	}
+
+	void clear () {
+		lru.clear();
+		map.clear();
+	}
+};
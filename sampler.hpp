@@ -0,0 +1,242 @@
+#pragma once
+#include "common.hpp"
+#include "interval.hpp"
+
+/*
+	Adaptive curve sampling
+
+	Starts from a coarse polyline (the uniformly sampled, cached tiles of a coarser level) and recursively halves the intervals
+	whose midpoint deviates from the chord by more than tol (in world units of y), up to depth times.
+	Subdivision goes breadth first, so that each level is a single batch evaluation of all the new midpoints.
+	Straight stretches only cost the coarse samples plus one midpoint per interval, while sharp features get refined down to the finest spacing.
+	Intervals with exactly one undefined (NaN) end are refined as well, to find where the function becomes undefined.
+
+	The midpoint test alone would also keep refining steep curves far off screen, and can't tell if a flat looking interval hides a spike,
+	so intervals are also bounded with interval arithmetic (Evaluator::execute_interval):
+	  intervals with both ends outside of cull_y are dropped if the curve provably stays outside of cull_y
+	  coarse intervals are not refined at all if the curve provably stays within tol of the chord (y bounds narrower than tol)
+
+	Intervals that still deviate at the finest level contain a jump (floor), a pole (tan, 1/x), the edge of the domain (sqrt) or are just steep,
+	see find_breaks, which bisects only these further and cuts the polyline with a NaN point at jumps and poles,
+	so that they don't get drawn as vertical lines and don't need a higher resolution everywhere.
+*/
+struct AdaptiveSampler {
+	struct Span {
+		float2 a, b;
+		bool   active; // still needs to be checked
+	};
+	std::vector<Span> intervals, next;
+
+	std::vector<float> xs, ys;
+
+	// intervals that are bisected further by find_breaks
+	struct Break {
+		int    interval;
+		float2 a, b;    // the half that changes the most (or contains the edge of the domain) of the last bisection
+		float  prev_dy; // |b.y - a.y| before the last bisection (INF if there was none)
+		bool   settled; // continuous after all
+		bool   cut;
+	};
+	std::vector<Break> breaks;
+
+	static constexpr int BREAK_STEPS = 12;
+
+	int evaluations = 0; // number of midpoints evaluated by the last refine, for debugging
+	int bounds = 0;      // number of interval evaluations of the last refine
+	int culled = 0;      // number of intervals dropped by them
+	int cuts = 0;        // number of jumps or poles found by the last refine
+
+	// refine the polyline in points, evaluate(xs, ys, count) samples the function at plot space x positions
+	// bound(x0, x1, &y) bounds the function over a plot space x range, returning false if that's not possible
+	// stops early once budget midpoints have been evaluated
+	template <typename FUNC, typename BOUND>
+	bool refine (std::vector<float2>* points, float tol, int depth, int budget, float2 cull_y, FUNC evaluate, BOUND bound) {
+		ZoneScoped;
+
+		evaluations = 0;
+		bounds = 0;
+		culled = 0;
+		cuts = 0;
+		if (points->size() < 2 || depth <= 0)
+			return true;
+
+		intervals.clear();
+		for (size_t i=1; i<points->size(); ++i)
+			intervals.push_back({ (*points)[i-1], (*points)[i], true });
+
+		auto outside = [&] (float y) {
+			return isnan(y) || y < cull_y.x || y > cull_y.y;
+		};
+
+		for (int level=0; level<depth; ++level) {
+			xs.clear();
+			for (auto& in : intervals) {
+				if (!in.active)
+					continue;
+
+				bool off = outside(in.a.y) && outside(in.b.y);
+				if (level == 0 || off) {
+					Interval y;
+					bounds++;
+					if (bound(in.a.x, in.b.x, &y)) {
+						bool provably_off  = y.empty() || y.hi < cull_y.x || y.lo > cull_y.y;
+						bool provably_flat = !y.undef && y.hi - y.lo <= tol; // both chord and curve lie within y
+						if ((off && provably_off) || provably_flat) {
+							in.active = false;
+							culled++;
+							continue;
+						}
+					}
+				}
+
+				xs.push_back((in.a.x + in.b.x) * 0.5f);
+			}
+
+			if (xs.empty() || evaluations + (int)xs.size() > budget)
+				break;
+			evaluations += (int)xs.size();
+
+			ys.resize(xs.size());
+			if (!evaluate(xs.data(), ys.data(), (int)xs.size()))
+				return false;
+
+			next.clear();
+			int mid_i = 0;
+			for (auto& in : intervals) {
+				if (!in.active) {
+					next.push_back(in);
+					continue;
+				}
+
+				float2 mid = float2(xs[mid_i], ys[mid_i]);
+				mid_i++;
+
+				// nothing to draw if both ends are undefined, NaN deviation (one end or the midpoint undefined) keeps refining
+				float dev = fabsf(mid.y - (in.a.y + in.b.y) * 0.5f);
+				bool split = !(isnan(in.a.y) && isnan(in.b.y)) && !(dev <= tol);
+
+				next.push_back({ in.a, mid, split });
+				next.push_back({ mid, in.b, split });
+			}
+			std::swap(intervals, next);
+		}
+
+		if (!find_breaks(tol, budget, evaluate))
+			return false;
+
+		points->clear();
+		points->push_back(intervals[0].a);
+
+		auto br = breaks.begin();
+		for (int i=0; i<(int)intervals.size(); ++i) {
+			auto& in = intervals[i];
+
+			if (br != breaks.end() && br->interval == i) {
+				// points right before and after the break, and a NaN point between them which cuts the line
+				if (br->a.x != in.a.x) points->push_back(br->a);
+				if (br->cut)           points->push_back(float2((br->a.x + br->b.x) * 0.5f, QNAN));
+				if (br->b.x != in.b.x) points->push_back(br->b);
+				++br;
+			}
+
+			points->push_back(in.b);
+		}
+		return true;
+	}
+
+	// bisect the intervals still active after refine for BREAK_STEPS more levels, always following the half that changes the most
+	//  continuous curves change less and less (by half per step if differentiable), at which point (or once the change is below tol) they settle
+	//  jumps keep changing by the same amount and poles by more and more, so they get cut
+	//  intervals with exactly one undefined end follow the edge of the domain, so the curve gets drawn right up to it
+	// once the bisection reaches the float resolution of x, the change of the last real step decides
+	template <typename FUNC>
+	bool find_breaks (float tol, int budget, FUNC evaluate) {
+		ZoneScoped;
+
+		breaks.clear();
+		for (int i=0; i<(int)intervals.size(); ++i) {
+			auto& in = intervals[i];
+			if (in.active)
+				breaks.push_back({ i, in.a, in.b, INF, false, false });
+		}
+
+		for (int step=0; step<BREAK_STEPS; ++step) {
+			xs.clear();
+			for (auto& br : breaks) {
+				float mid = (br.a.x + br.b.x) * 0.5f;
+				if (!br.settled && mid != br.a.x && mid != br.b.x)
+					xs.push_back(mid);
+			}
+
+			if (xs.empty() || evaluations + (int)xs.size() > budget)
+				break;
+			evaluations += (int)xs.size();
+
+			ys.resize(xs.size());
+			if (!evaluate(xs.data(), ys.data(), (int)xs.size()))
+				return false;
+
+			int mid_i = 0;
+			for (auto& br : breaks) {
+				float mid = (br.a.x + br.b.x) * 0.5f;
+				if (br.settled || mid == br.a.x || mid == br.b.x)
+					continue;
+
+				float2 m = float2(xs[mid_i], ys[mid_i]);
+				mid_i++;
+
+				if (isnan(br.a.y) != isnan(br.b.y)) {
+					// edge of the domain
+					if (isnan(m.y) == isnan(br.a.y)) br.a = m;
+					else                             br.b = m;
+					continue;
+				}
+				if (isnan(m.y)) {
+					// undefined inside, follow the edge on the left
+					br.b = m;
+					continue;
+				}
+
+				float dy = fabsf(br.b.y - br.a.y);
+				float dl = fabsf(m.y - br.a.y), dr = fabsf(br.b.y - m.y);
+				if (dl >= dr) br.b = m;
+				else          br.a = m;
+
+				br.prev_dy = dy;
+				if (max(dl, dr) <= tol)
+					br.settled = true;
+			}
+		}
+
+		for (auto& br : breaks) {
+			if (br.settled || isnan(br.a.y) || isnan(br.b.y))
+				continue;
+
+			// >= so that infinite ends (poles hit exactly) get cut too
+			float dy = fabsf(br.b.y - br.a.y);
+			br.cut = dy > tol && dy >= br.prev_dy * 0.9f;
+			cuts += br.cut;
+		}
+		return true;
+	}
+};
+
+// an adaptively sampled curve, reused while its key stays the same
+struct SampledCurve {
+	struct Key {
+		int   code_stamp = -1;
+		int   level, start, end; // coarse samples
+		int   depth;
+		float tol;
+		float2 cull_y;
+		bool  log_x, log_y;
+
+		bool operator== (Key const& r) const {
+			return code_stamp == r.code_stamp && level == r.level && start == r.start && end == r.end &&
+				depth == r.depth && tol == r.tol && cull_y.x == r.cull_y.x && cull_y.y == r.cull_y.y && log_x == r.log_x && log_y == r.log_y;
+		}
+	};
+	Key key;
+
+	std::vector<float2> points;
+};
@@ -0,0 +1,164 @@
+#pragma once
+#include "common.hpp"
+
+#if defined(__AVX2__)
+	#include <immintrin.h>
+	#define SIMD_AVX2  1
+	#define SIMD_WIDTH 8
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <emmintrin.h>
+	#define SIMD_SSE   1
+	#define SIMD_WIDTH 4
+#else
+	#define SIMD_WIDTH 1
+#endif
+
+/*
+	Thin wrapper over the widest float vector we are compiled for
+	 AVX2 -> 8 lanes (build with -mavx2 or /arch:AVX2, see meson option 'avx2')
+	 SSE2 -> 4 lanes (always available on x64)
+	 else -> 1 lane, plain float
+
+	Used by the batch evaluator to write lane kernels once and get the simd version for free
+	all loads/stores are unaligned, since the lane arrays are just std::vector<float>
+*/
+struct vfloat {
+#if SIMD_AVX2
+	__m256 v;
+
+	vfloat () {}
+	vfloat (__m256 v): v{v} {}
+	vfloat (float f): v{_mm256_set1_ps(f)} {}
+
+	static vfloat load (float const* ptr) { return _mm256_loadu_ps(ptr); }
+	void store (float* ptr) const { _mm256_storeu_ps(ptr, v); }
+
+	friend vfloat operator+ (vfloat a, vfloat b) { return _mm256_add_ps(a.v, b.v); }
+	friend vfloat operator- (vfloat a, vfloat b) { return _mm256_sub_ps(a.v, b.v); }
+	friend vfloat operator* (vfloat a, vfloat b) { return _mm256_mul_ps(a.v, b.v); }
+	friend vfloat operator/ (vfloat a, vfloat b) { return _mm256_div_ps(a.v, b.v); }
+	friend vfloat operator- (vfloat a) { return _mm256_xor_ps(a.v, _mm256_set1_ps(-0.0f)); }
+
+	// comparisons return masks (all bits set in true lanes)
+	friend vfloat operator<  (vfloat a, vfloat b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); }
+	friend vfloat operator<= (vfloat a, vfloat b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ); }
+	friend vfloat operator>  (vfloat a, vfloat b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ); }
+	friend vfloat operator>= (vfloat a, vfloat b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ); }
+	friend vfloat operator== (vfloat a, vfloat b) { return _mm256_cmp_ps(a.v, b.v, _CMP_EQ_OQ); }
+
+	friend vfloat operator& (vfloat a, vfloat b) { return _mm256_and_ps(a.v, b.v); }
+	friend vfloat operator| (vfloat a, vfloat b) { return _mm256_or_ps (a.v, b.v); }
+	friend vfloat operator^ (vfloat a, vfloat b) { return _mm256_xor_ps(a.v, b.v); }
+	friend vfloat andnot (vfloat mask, vfloat a) { return _mm256_andnot_ps(mask.v, a.v); } // ~mask & a
+
+	friend vfloat select (vfloat mask, vfloat a, vfloat b) { return _mm256_blendv_ps(b.v, a.v, mask.v); } // mask ? a : b
+	friend bool any (vfloat mask) { return _mm256_movemask_ps(mask.v) != 0; }
+	friend bool all (vfloat mask) { return _mm256_movemask_ps(mask.v) == 0xff; }
+
+	friend vfloat min (vfloat a, vfloat b) { return _mm256_min_ps(a.v, b.v); }
+	friend vfloat max (vfloat a, vfloat b) { return _mm256_max_ps(a.v, b.v); }
+	friend vfloat sqrt (vfloat a) { return _mm256_sqrt_ps(a.v); }
+#elif SIMD_SSE
+	__m128 v;
+
+	vfloat () {}
+	vfloat (__m128 v): v{v} {}
+	vfloat (float f): v{_mm_set1_ps(f)} {}
+
+	static vfloat load (float const* ptr) { return _mm_loadu_ps(ptr); }
+	void store (float* ptr) const { _mm_storeu_ps(ptr, v); }
+
+	friend vfloat operator+ (vfloat a, vfloat b) { return _mm_add_ps(a.v, b.v); }
+	friend vfloat operator- (vfloat a, vfloat b) { return _mm_sub_ps(a.v, b.v); }
+	friend vfloat operator* (vfloat a, vfloat b) { return _mm_mul_ps(a.v, b.v); }
+	friend vfloat operator/ (vfloat a, vfloat b) { return _mm_div_ps(a.v, b.v); }
+	friend vfloat operator- (vfloat a) { return _mm_xor_ps(a.v, _mm_set1_ps(-0.0f)); }
+
+	// comparisons return masks (all bits set in true lanes)
+	friend vfloat operator<  (vfloat a, vfloat b) { return _mm_cmplt_ps(a.v, b.v); }
+	friend vfloat operator<= (vfloat a, vfloat b) { return _mm_cmple_ps(a.v, b.v); }
+	friend vfloat operator>  (vfloat a, vfloat b) { return _mm_cmpgt_ps(a.v, b.v); }
+	friend vfloat operator>= (vfloat a, vfloat b) { return _mm_cmpge_ps(a.v, b.v); }
+	friend vfloat operator== (vfloat a, vfloat b) { return _mm_cmpeq_ps(a.v, b.v); }
+
+	friend vfloat operator& (vfloat a, vfloat b) { return _mm_and_ps(a.v, b.v); }
+	friend vfloat operator| (vfloat a, vfloat b) { return _mm_or_ps (a.v, b.v); }
+	friend vfloat operator^ (vfloat a, vfloat b) { return _mm_xor_ps(a.v, b.v); }
+	friend vfloat andnot (vfloat mask, vfloat a) { return _mm_andnot_ps(mask.v, a.v); } // ~mask & a
+
+	friend vfloat select (vfloat mask, vfloat a, vfloat b) { return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v)); } // mask ? a : b
+	friend bool any (vfloat mask) { return _mm_movemask_ps(mask.v) != 0; }
+	friend bool all (vfloat mask) { return _mm_movemask_ps(mask.v) == 0xf; }
+
+	friend vfloat min (vfloat a, vfloat b) { return _mm_min_ps(a.v, b.v); }
+	friend vfloat max (vfloat a, vfloat b) { return _mm_max_ps(a.v, b.v); }
+	friend vfloat sqrt (vfloat a) { return _mm_sqrt_ps(a.v); }
+#else
+	float v;
+
+	vfloat () {}
+	vfloat (float f): v{f} {}
+
+	static vfloat load (float const* ptr) { return *ptr; }
+	void store (float* ptr) const { *ptr = v; }
+
+	friend vfloat operator+ (vfloat a, vfloat b) { return a.v + b.v; }
+	friend vfloat operator- (vfloat a, vfloat b) { return a.v - b.v; }
+	friend vfloat operator* (vfloat a, vfloat b) { return a.v * b.v; }
+	friend vfloat operator/ (vfloat a, vfloat b) { return a.v / b.v; }
+	friend vfloat operator- (vfloat a) { return -a.v; }
+#endif
+};
+
+#if SIMD_WIDTH > 1
+// int32 lanes matching vfloat, only what the vector math functions need (exponent bit tricks and quadrant selection)
+struct vint {
+#if SIMD_AVX2
+	__m256i v;
+
+	vint () {}
+	vint (__m256i v): v{v} {}
+	vint (int i): v{_mm256_set1_epi32(i)} {}
+
+	static vint round (vfloat f) { return _mm256_cvtps_epi32(f.v); }  // round to nearest even
+	static vint trunc (vfloat f) { return _mm256_cvttps_epi32(f.v); } // round towards zero
+	static vint bits  (vfloat f) { return _mm256_castps_si256(f.v); }
+
+	vfloat to_float () const { return _mm256_cvtepi32_ps(v); }
+	vfloat as_float () const { return _mm256_castsi256_ps(v); }
+
+	friend vint operator+ (vint a, vint b) { return _mm256_add_epi32(a.v, b.v); }
+	friend vint operator- (vint a, vint b) { return _mm256_sub_epi32(a.v, b.v); }
+	friend vint operator& (vint a, vint b) { return _mm256_and_si256(a.v, b.v); }
+	friend vint operator| (vint a, vint b) { return _mm256_or_si256 (a.v, b.v); }
+	friend vint operator^ (vint a, vint b) { return _mm256_xor_si256(a.v, b.v); }
+	friend vint operator== (vint a, vint b) { return _mm256_cmpeq_epi32(a.v, b.v); }
+
+	template <int N> vint shl () const { return _mm256_slli_epi32(v, N); }
+	template <int N> vint shr () const { return _mm256_srli_epi32(v, N); } // logical shift
+#else
+	__m128i v;
+
+	vint () {}
+	vint (__m128i v): v{v} {}
+	vint (int i): v{_mm_set1_epi32(i)} {}
+
+	static vint round (vfloat f) { return _mm_cvtps_epi32(f.v); }  // round to nearest even
+	static vint trunc (vfloat f) { return _mm_cvttps_epi32(f.v); } // round towards zero
+	static vint bits  (vfloat f) { return _mm_castps_si128(f.v); }
+
+	vfloat to_float () const { return _mm_cvtepi32_ps(v); }
+	vfloat as_float () const { return _mm_castsi128_ps(v); }
+
+	friend vint operator+ (vint a, vint b) { return _mm_add_epi32(a.v, b.v); }
+	friend vint operator- (vint a, vint b) { return _mm_sub_epi32(a.v, b.v); }
+	friend vint operator& (vint a, vint b) { return _mm_and_si128(a.v, b.v); }
+	friend vint operator| (vint a, vint b) { return _mm_or_si128 (a.v, b.v); }
+	friend vint operator^ (vint a, vint b) { return _mm_xor_si128(a.v, b.v); }
+	friend vint operator== (vint a, vint b) { return _mm_cmpeq_epi32(a.v, b.v); }
+
+	template <int N> vint shl () const { return _mm_slli_epi32(v, N); }
+	template <int N> vint shr () const { return _mm_srli_epi32(v, N); } // logical shift
+#endif
+};
+#endif
@@ -0,0 +1,74 @@
+#pragma once
+#include "common.hpp"
+#include <mutex>
+#include <deque>
+
+/*
+	Global table of interned identifiers
+	every identifier gets a dense Symbol id the first time it is seen (by tokenize), so everything after that
+	compares and looks up names by integer instead of hashing strings, and per name data can live in flat arrays indexed by Symbol
+
+	Symbols are never removed, names are copied into the table, so they outlive the text of the equation they came from
+	Names of derivatives (f'') are symbols as well, with base and order splitting them into the function name and the number of primes
+
+	tokenize can run on multiple threads, so the table is locked (it is only accessed while compiling, never while evaluating)
+*/
+typedef uint32_t Symbol;
+constexpr Symbol NO_SYMBOL = 0;
+
+struct SymbolTable {
+	struct Entry {
+		std::string_view name;
+		Symbol           base;  // name without the primes of a derivative, itself for anything else
+		int              order; // number of primes
+	};
+
+	std::mutex mutex;
+
+	std::deque<std::string> storage; // deque keeps the strings in place, so the string_views stay valid
+	std::vector<Entry>      entries = { { "", NO_SYMBOL, 0 } }; // indexed by Symbol
+	std::unordered_map<std::string_view, Symbol> ids;
+
+	Symbol intern (std::string_view name) {
+		std::lock_guard<std::mutex> lock(mutex);
+		return _intern(name);
+	}
+
+	// the number of symbols so far, arrays indexed by Symbol need to be at least this large
+	Symbol count () {
+		std::lock_guard<std::mutex> lock(mutex);
+		return (Symbol)entries.size();
+	}
+
+	std::string_view name (Symbol sym) {
+		std::lock_guard<std::mutex> lock(mutex);
+		return entries[sym].name;
+	}
+	// for the name of a derivative f'' returns the order (2) and sets base to f, returns 0 for anything else
+	int derivative (Symbol sym, Symbol* base) {
+		std::lock_guard<std::mutex> lock(mutex);
+		*base = entries[sym].base;
+		return entries[sym].order;
+	}
+
+	Symbol _intern (std::string_view name) {
+		auto it = ids.find(name);
+		if (it != ids.end())
+			return it->second;
+
+		// intern the function name first, so derivatives of derivatives all share the same base
+		size_t len = name.find('\'');
+		Symbol base = len != std::string_view::npos ? _intern(name.substr(0, len)) : (Symbol)entries.size();
+		int order = 0;
+		for (char c : name)
+			order += c == '\'';
+
+		std::string_view stored = storage.emplace_back(name);
+		Symbol sym = (Symbol)entries.size();
+		entries.push_back({ stored, base, order });
+		ids.emplace(stored, sym);
+		return sym;
+	}
+};
+
+SymbolTable symbols;
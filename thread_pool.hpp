@@ -0,0 +1,153 @@
+#pragma once
+#include "common.hpp"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+
+/*
+	Persistent pool of worker threads for per-frame work that splits into independent jobs
+
+	run(count, func) calls func(job, thread) for jobs 0..count-1 and returns once all of them are done.
+	Each thread owns a deque of job indices, which start out as contiguous blocks of the jobs (in order, so neighbouring jobs stay on one thread),
+	threads pop from the front of their own deque and, once that is empty, steal from the back of the others.
+	So uneven jobs (steep curves next to flat ones) still keep all threads busy without a shared queue everyone contends on.
+
+	The calling thread works as thread 0, so threads can index per-thread scratch data with [0, thread_count()).
+	Jobs can't add more jobs, which means a thread that finds all deques empty can stop.
+	The deques are tiny and only touched once per job, so they are simply locked.
+*/
+struct WorkStealingPool {
+	struct Deque {
+		std::mutex      mutex;
+		std::deque<int> jobs;
+	};
+	std::vector<std::unique_ptr<Deque>> deques; // one per thread, including the calling thread
+	std::vector<std::thread> workers;
+
+	std::mutex              mutex;
+	std::condition_variable wake, finished;
+	int                     generation = 0; // incremented by every run, workers wait for it to change
+	int                     busy = 0;       // workers that did not finish the current run yet
+	bool                    shutdown = false;
+
+	std::function<void (int job, int thread)> func;
+
+	WorkStealingPool () {}
+	~WorkStealingPool () { stop(); }
+
+	int thread_count () const { return (int)deques.size(); }
+
+	// start count threads in total (the calling thread plus count-1 workers), 0 uses one per hardware thread
+	void start (int count=0) {
+		stop();
+
+		if (count <= 0)
+			count = max((int)std::thread::hardware_concurrency(), 1);
+
+		for (int i=0; i<count; ++i)
+			deques.push_back(std::make_unique<Deque>());
+
+		shutdown = false;
+		for (int i=1; i<count; ++i)
+			workers.emplace_back(&WorkStealingPool::worker, this, i);
+	}
+	void stop () {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			shutdown = true;
+		}
+		wake.notify_all();
+
+		for (auto& t : workers)
+			t.join();
+		workers.clear();
+		deques.clear();
+	}
+
+	template <typename FUNC>
+	void run (int count, FUNC job_func) {
+		ZoneScoped;
+
+		if (deques.empty())
+			start();
+
+		int threads = thread_count();
+		if (threads == 1 || count <= 1) {
+			for (int job=0; job<count; ++job)
+				job_func(job, 0);
+			return;
+		}
+
+		for (int t=0; t<threads; ++t) {
+			auto& d = *deques[t];
+			std::lock_guard<std::mutex> lock(d.mutex);
+			for (int job = count * t / threads; job < count * (t+1) / threads; ++job)
+				d.jobs.push_back(job);
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			func = job_func;
+			busy = threads - 1;
+			generation++;
+		}
+		wake.notify_all();
+
+		work(0);
+
+		std::unique_lock<std::mutex> lock(mutex);
+		finished.wait(lock, [&] () { return busy == 0; });
+		func = nullptr;
+	}
+
+	bool pop (int thread, int* job) {
+		auto& d = *deques[thread];
+		std::lock_guard<std::mutex> lock(d.mutex);
+		if (d.jobs.empty())
+			return false;
+		*job = d.jobs.front();
+		d.jobs.pop_front();
+		return true;
+	}
+	bool steal (int thread, int* job) {
+		int threads = thread_count();
+		for (int i=1; i<threads; ++i) {
+			auto& d = *deques[(thread + i) % threads];
+			std::lock_guard<std::mutex> lock(d.mutex);
+			if (!d.jobs.empty()) {
+				*job = d.jobs.back();
+				d.jobs.pop_back();
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void work (int thread) {
+		int job;
+		while (pop(thread, &job) || steal(thread, &job))
+			func(job, thread);
+	}
+
+	void worker (int thread) {
+		int seen = 0;
+		for (;;) {
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [&] () { return shutdown || generation != seen; });
+				if (shutdown) return;
+				seen = generation;
+			}
+
+			work(thread);
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				busy--;
+			}
+			finished.notify_one();
+		}
+	}
+};
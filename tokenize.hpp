@@ -1,6 +1,7 @@
 #pragma once
 #include "common.hpp"
 #include "kisslib/strparse.hpp"
+#include "symbols.hpp"
 
 /*
 	Tokenize a string into tokens
@@ -12,6 +13,8 @@
 
 	tokens contain pointers to the range of characters they came from (keep the original string allocated!)
 
+	identifiers are interned into the global symbol table (see symbols.hpp)
+
 	literals also are parsed for their float value
 
 	-5.0 is always  T_MINUS, T_LITERAL
@@ -20,6 +23,7 @@
 
 	func( is tokenized as  T_IDENTIFIER, T_PAREN_OPEN  (there is no T_FUNCTION_CALL)
 	this is handled in parsing
+	func'( (derivative) is  T_IDENTIFIER, T_PRIME, T_PAREN_OPEN
 */
 
 enum TokenType {
@@ -44,12 +48,15 @@ enum TokenType {
 	T_COMMA,       // ,
 
 	T_EQUALS,      // =
+
+	T_PRIME,       // '
 };
 
 struct Token {
 	TokenType   type;
 
 	float       value; // only for T_LITERAL
+	Symbol      sym;   // only for T_IDENTIFIER
 
 	char const* begin;
 	char const* end;
@@ -59,63 +66,151 @@ struct Token {
 	}
 };
 
+// tokenize the next token at cur (after any whitespace), which is T_EOI at the end of the string
+// advances cur past the token, false on errors
+inline bool next_token (const char*& cur, Token* tok, std::string* err_msg) {
+	using namespace parse;
+
+	whitespace(cur); // skip all whitespace until next token
+
+	const char* start = cur;
+
+	if (*cur == '\0') {
+		*tok = { T_EOI, 0, NO_SYMBOL, cur, cur+1 };
+		return true;
+	}
+
+	TokenType type;
+	float value = 0;
+	Symbol sym = NO_SYMBOL;
+
+	if (is_decimal_c(*cur)) {
+		if (!parse_float(cur, &value)) {
+			*err_msg = prints("tokenize: parse_float error: \n\"%s\"", cur);
+			return false;
+		}
+
+		type = T_LITERAL;
+	}
+	else if (is_ident_start_c(*cur)) {
+
+		while (is_ident_c(*cur))
+			cur++; // find end of identifier
+
+		type = T_IDENTIFIER;
+		sym = symbols.intern(std::string_view(start, cur - start));
+	}
+	else {
+		switch (*cur) {
+			case '+': type = T_PLUS;          break;
+			case '-': type = T_MINUS;         break;
+			case '*': type = T_MULTIPLY;      break;
+			case '/': type = T_DIVIDE;        break;
+			case '^': type = T_POWER;         break;
+
+			case '(': type = T_PAREN_OPEN;    break;
+			case ')': type = T_PAREN_CLOSE;   break;
+			case ',': type = T_COMMA;         break;
+
+			case '=': type = T_EQUALS;        break;
+
+			case '\'': type = T_PRIME;        break;
+
+			default: {
+				*err_msg = prints("tokenize: unknown token: \n\"%s\"", cur);
+				return false;
+			}
+		}
+		cur++; // single-char token
+	}
+
+	*tok = { type, value, sym, start, cur };
+	return true;
+}
+
 bool tokenize (const char* str, std::vector<Token>* tok, std::string* err_msg) {
 	ZoneScoped;
 
-	using namespace parse;
-
 	const char* cur = str;
 	for (;;) {
-		whitespace(cur); // skip all whitespace until next token
+		Token t;
+		if (!next_token(cur, &t, err_msg))
+			return false;
 
-		if (*cur == '\0')
-			break; // stop
+		tok->push_back(t);
+		if (t.type == T_EOI)
+			return true;
+	}
+}
 
-		const char* start = cur;
+inline bool same_token (Token const& l, Token const& r) {
+	return l.type == r.type && l.value == r.value && l.sym == r.sym;
+}
 
-		TokenType type;
-		float value = 0;
+// tokenize str after an edit of old_str, reusing the tokens that tokens holds for old_str (which still needs to be allocated)
+// only the text from the last token before the edit up to the first token after it (that starts in the same place) is tokenized again,
+// the other tokens are repointed into str, so typing into long equations doesn't tokenize all of them every time
+// changed is set to false if the tokens came out the same (ignoring where they point to), like for edits of whitespace
+bool retokenize (const char* old_str, const char* str, std::vector<Token>* tokens, bool* changed, std::string* err_msg) {
+	ZoneScoped;
 
-		if (is_decimal_c(*cur)) {
-			if (!parse_float(cur, &value)) {
-				*err_msg = prints("tokenize: parse_float error: \n\"%s\"", cur);
-				return false;
-			}
+	// parse_float may look a few chars past the end of a literal (1e+x is 1 followed by e+x)
+	constexpr ptrdiff_t LOOKAHEAD = 4;
 
-			type = T_LITERAL;
-		}
-		else if (is_ident_start_c(*cur)) {
+	auto& old = *tokens;
 
-			while (is_ident_c(*cur))
-				cur++; // find end of identifier
+	// edited span, as the unchanged text before and after it
+	ptrdiff_t old_len = (ptrdiff_t)strlen(old_str), len = (ptrdiff_t)strlen(str);
+	ptrdiff_t prefix = 0, suffix = 0;
+	while (prefix < old_len && prefix < len && old_str[prefix] == str[prefix])
+		prefix++;
+	while (suffix < old_len - prefix && suffix < len - prefix && old_str[old_len-1 - suffix] == str[len-1 - suffix])
+		suffix++;
+	ptrdiff_t delta = len - old_len;
 
-			type = T_IDENTIFIER;
-		}
-		else {
-			switch (*cur) {
-				case '+': type = T_PLUS;          break;
-				case '-': type = T_MINUS;         break;
-				case '*': type = T_MULTIPLY;      break;
-				case '/': type = T_DIVIDE;        break;
-				case '^': type = T_POWER;         break;
-
-				case '(': type = T_PAREN_OPEN;    break;
-				case ')': type = T_PAREN_CLOSE;   break;
-				case ',': type = T_COMMA;         break;
-
-				case '=': type = T_EQUALS;        break;
-
-				default: {
-					*err_msg = prints("tokenize: unknown token: \n\"%s\"", cur);
-					return false;
-				}
+	// tokens before the edit can be kept, if it can't change where they end
+	size_t first = 0;
+	while (old[first].type != T_EOI && (old[first].end - old_str) + LOOKAHEAD <= prefix)
+		first++;
+
+	// tokenizing doesn't depend on anything before the start of a token,
+	// so once a token starts in the unchanged text after the edit, where a token of old_str started, the rest is the same as before
+	std::vector<Token> retok;
+	size_t resume;
+
+	const char* cur = str + (first > 0 ? old[first-1].end - old_str : 0);
+	for (;;) {
+		Token t;
+		if (!next_token(cur, &t, err_msg))
+			return false;
+
+		ptrdiff_t begin = t.begin - str;
+		if (begin >= len - suffix) {
+			const char* old_begin = old_str + (begin - delta);
+			auto it = std::lower_bound(old.begin() + first, old.end(), old_begin, [] (Token const& t, const char* p) { return t.begin < p; });
+			if (it != old.end() && it->begin == old_begin) {
+				resume = it - old.begin();
+				break;
 			}
-			cur++; // single-char token
 		}
+		assert(t.type != T_EOI); // always the same as the old one
+		retok.push_back(t);
+	}
 
-		tok->push_back({ type, value, start, cur });
+	*changed = retok.size() != resume - first;
+	for (size_t i=0; i<retok.size() && !*changed; ++i)
+		*changed = !same_token(retok[i], old[first + i]);
+
+	for (size_t i=0; i<first; ++i) {
+		old[i].begin = str + (old[i].begin - old_str);
+		old[i].end   = str + (old[i].end   - old_str);
+	}
+	for (size_t i=resume; i<old.size(); ++i) {
+		old[i].begin = str + ((old[i].begin - old_str) + delta);
+		old[i].end   = str + ((old[i].end   - old_str) + delta);
 	}
 
-	tok->push_back({ T_EOI, 0, cur, cur+1 });
+	old.erase(old.begin() + first, old.begin() + resume);
+	old.insert(old.begin() + first, retok.begin(), retok.end());
 	return true;
 }
@@ -0,0 +1,303 @@
+#pragma once
+#include "common.hpp"
+#include "simd.hpp"
+
+/*
+	Vector math functions over vfloat lanes, used by the batch versions of the std_functions
+
+	Polynomial approximations with the coefficients and range reductions of the cephes single precision library
+	Max error vs. the correctly rounded result (measured against double precision libm, SSE2 and AVX2 builds):
+	  vsin, vcos    |x| <= 64               2.1 ulp
+	                |x| <= 8192             abs. error < 8e-8 (ulp error grows near the zeros, since the range reduction is only that exact)
+	  vtan          |x| <= 64               2.6 ulp
+	  vasin, vacos  |x| <= 1                2.4 ulp
+	  vatan         all x                   3.2 ulp
+	  vexp          -87.3 <= x <= 88.3      1.0 ulp
+	  vlog          normal x > 0            0.9 ulp
+	  vpow          a > 0                   1 + 1.6*|b*ln(a)| ulp  (computed as exp(b*log(a)), so errors of log get scaled up)
+	  vsqrt, vabs, vsign, vfloor, vceil, vround, vmin, vmax  exact
+	  vmod          |a/b| < 2^22, finite b  exact (same results as mymod)
+
+	Lanes outside these ranges (including inf, nan, zero or negative log arguments) make the whole vector
+	fall back to the scalar libm function, so results outside the listed ranges always match the scalar evaluator.
+	With SIMD_WIDTH == 1 everything is just the scalar libm function.
+*/
+
+inline float mymod (float a, float b) {
+	float val = fmodf(a, b);
+	//if (b > 0.0f) if (a < 0.0f) val += b;
+	//else          if (a > 0.0f) val += b;
+	//
+	if (val*b < 0.0f) // differing sign (checking a instead of val would turn exact multiples into b)
+		val += b;
+	return val;
+}
+// -1, 0 or 1, nan stays nan and the sign of zero is kept
+inline float mysign (float x) {
+	return x > 0.0f ? 1.0f : x < 0.0f ? -1.0f : x;
+}
+
+#if SIMD_WIDTH > 1
+
+// scalar fallback, applies func to every lane
+template <typename FUNC>
+inline vfloat vscalar (vfloat a, FUNC func) {
+	float tmp[SIMD_WIDTH];
+	a.store(tmp);
+	for (int i=0; i<SIMD_WIDTH; ++i)
+		tmp[i] = func(tmp[i]);
+	return vfloat::load(tmp);
+}
+template <typename FUNC>
+inline vfloat vscalar (vfloat a, vfloat b, FUNC func) {
+	float ta[SIMD_WIDTH], tb[SIMD_WIDTH];
+	a.store(ta);
+	b.store(tb);
+	for (int i=0; i<SIMD_WIDTH; ++i)
+		ta[i] = func(ta[i], tb[i]);
+	return vfloat::load(ta);
+}
+
+inline vfloat vsign_bit () { return vfloat(-0.0f); }
+
+inline vfloat vabs (vfloat x) { return andnot(vsign_bit(), x); }
+inline vfloat vsqrt (vfloat x) { return sqrt(x); }
+inline vfloat vmin (vfloat a, vfloat b) { return min(a, b); }
+inline vfloat vmax (vfloat a, vfloat b) { return max(a, b); }
+inline vfloat vsign (vfloat x) { return select(x > 0.0f, vfloat(1.0f), select(x < 0.0f, vfloat(-1.0f), x)); }
+
+// floor, ceil and round via truncating int conversion
+// values >= 2^23 are already integers (and inf/nan), these are passed through
+// the sign of x is or'ed back in to get -0 where libm returns -0
+inline vfloat vfloor (vfloat x) {
+	vfloat t = vint::trunc(x).to_float();
+	t = select(t > x, t - 1.0f, t);
+	return select(vabs(x) < 8388608.0f, t | (x & vsign_bit()), x);
+}
+inline vfloat vceil (vfloat x) {
+	vfloat t = vint::trunc(x).to_float();
+	t = select(t < x, t + 1.0f, t);
+	return select(vabs(x) < 8388608.0f, t | (x & vsign_bit()), x);
+}
+inline vfloat vround (vfloat x) { // round half away from zero like roundf
+	vfloat t = vint::trunc(x).to_float();
+	vfloat one = vfloat(1.0f) | (x & vsign_bit());
+	t = t + (one & (vabs(x - t) >= 0.5f)); // x - t is exact
+	return select(vabs(x) < 8388608.0f, t | (x & vsign_bit()), x);
+}
+
+// fmodf-style remainder a - b*trunc(a/b), then moved to the sign of b like mymod
+// in float the product b*trunc(a/b) gets rounded, which is off by up to 0.5 ulp of a (a whole period where the remainder is near 0 or b)
+// in double it is exact for |a/b| < 2^22: the product fits in 46 bits and the double quotient can't round across an integer
+inline vfloat vmod (vfloat a, vfloat b) {
+	vfloat q = a / b;
+	if (!all((vabs(q) < 4194304.0f) & (vabs(b) < INF)))
+		return vscalar(a, b, mymod);
+
+	vfloat r = vscalar(a, b, [] (float x, float y) {
+		return (float)((double)x - (double)y * trunc((double)x / (double)y));
+	});
+	r = select(r == 0.0f, a & vsign_bit(), r); // zero has the sign of a like fmodf
+	return select(r * b < 0.0f, r + b, r);
+}
+
+// sin and cos share the range reduction: x = j*PI/4 + r with j even and |r| <= PI/4
+// r is computed with PI/4 split into 3 parts, which is exact enough up to |x| = 8192
+static constexpr float VM_FOPI = 1.27323954473516f; // 4/PI
+static constexpr float VM_DP1  = 0.78515625f;
+static constexpr float VM_DP2  = 2.4187564849853515625e-4f;
+static constexpr float VM_DP3  = 3.77489497744594108e-8f;
+
+inline vfloat vsin_poly (vfloat r, vfloat z) {
+	return ((-1.9515295891e-4f * z + 8.3321608736e-3f) * z - 1.6666654611e-1f) * z * r + r;
+}
+inline vfloat vcos_poly (vfloat z) {
+	return ((2.443315711809948e-5f * z - 1.388731625493765e-3f) * z + 4.166664568298827e-2f) * z * z - 0.5f * z + 1.0f;
+}
+
+inline vfloat vsin (vfloat x) {
+	vfloat ax = vabs(x);
+	if (!all(ax <= 8192.0f))
+		return vscalar(x, sinf);
+
+	vint j = vint::trunc(ax * VM_FOPI);
+	j = (j + 1) & vint(~1);
+	vfloat y = j.to_float();
+
+	vfloat r = ((ax - y * VM_DP1) - y * VM_DP2) - y * VM_DP3;
+	vfloat z = r * r;
+
+	vfloat use_cos = ((j & vint(2)) == vint(2)).as_float();
+	vfloat res = select(use_cos, vcos_poly(z), vsin_poly(r, z));
+
+	vfloat sign = (j & vint(4)).shl<29>().as_float() ^ (x & vsign_bit());
+	return res ^ sign;
+}
+inline vfloat vcos (vfloat x) {
+	vfloat ax = vabs(x);
+	if (!all(ax <= 8192.0f))
+		return vscalar(x, cosf);
+
+	vint j = vint::trunc(ax * VM_FOPI);
+	j = (j + 1) & vint(~1);
+	vfloat y = j.to_float();
+
+	vfloat r = ((ax - y * VM_DP1) - y * VM_DP2) - y * VM_DP3;
+	vfloat z = r * r;
+
+	vfloat use_sin = ((j & vint(2)) == vint(2)).as_float();
+	vfloat res = select(use_sin, vsin_poly(r, z), vcos_poly(z));
+
+	vfloat sign = ((j + vint(2)) & vint(4)).shl<29>().as_float();
+	return res ^ sign;
+}
+inline vfloat vtan (vfloat x) {
+	vfloat ax = vabs(x);
+	if (!all(ax <= 8192.0f))
+		return vscalar(x, tanf);
+
+	vint j = vint::trunc(ax * VM_FOPI);
+	j = (j + 1) & vint(~1);
+	vfloat y = j.to_float();
+
+	vfloat r = ((ax - y * VM_DP1) - y * VM_DP2) - y * VM_DP3;
+	vfloat z = r * r;
+
+	vfloat res = (((((9.38540185543e-3f * z + 3.11992232697e-3f) * z + 2.44301354525e-2f) * z
+		+ 5.34112807005e-2f) * z + 1.33387994085e-1f) * z + 3.33331568548e-1f) * z * r + r;
+
+	vfloat cot = ((j & vint(2)) == vint(2)).as_float();
+	res = select(cot, -1.0f / res, res);
+
+	return res ^ (x & vsign_bit());
+}
+
+// asin(x) for 0 <= x <= 0.5
+inline vfloat vasin_poly (vfloat x) {
+	vfloat z = x * x;
+	return ((((4.2163199048e-2f * z + 2.4181311049e-2f) * z + 4.5470025998e-2f) * z
+		+ 7.4953002686e-2f) * z + 1.6666752422e-1f) * z * x + x;
+}
+
+inline vfloat vasin (vfloat x) {
+	vfloat ax = vabs(x);
+	if (!all(ax <= 1.0f))
+		return vscalar(x, asinf);
+
+	// asin(x) = PI/2 - 2*asin(sqrt((1-x)/2)) for x > 0.5
+	vfloat big = ax > 0.5f;
+	vfloat p = vasin_poly(select(big, sqrt(0.5f * (1.0f - ax)), ax));
+	vfloat res = select(big, (PI/2) - (p + p), p);
+
+	return res | (x & vsign_bit());
+}
+inline vfloat vacos (vfloat x) {
+	vfloat ax = vabs(x);
+	if (!all(ax <= 1.0f))
+		return vscalar(x, acosf);
+
+	// acos(x) = 2*asin(sqrt((1-x)/2)) for x > 0.5, PI - 2*asin(sqrt((1+x)/2)) for x < -0.5, PI/2 - asin(x) else
+	vfloat big = ax > 0.5f;
+	vfloat p = vasin_poly(select(big, sqrt(0.5f * (1.0f - ax)), ax));
+
+	vfloat small_res = (PI/2) - (p ^ (x & vsign_bit()));
+	vfloat big_res = select(x < 0.0f, PI - (p + p), p + p);
+	return select(big, big_res, small_res);
+}
+inline vfloat vatan (vfloat x) {
+	vfloat ax = vabs(x);
+
+	// reduce to |x| <= tan(PI/8)
+	vfloat big = ax > 2.414213562373095f;
+	vfloat mid = andnot(big, ax > 0.4142135623730950f);
+
+	vfloat y = (vfloat(PI/2) & big) | (vfloat(PI/4) & mid);
+	vfloat r = select(big, -1.0f / ax, select(mid, (ax - 1.0f) / (ax + 1.0f), ax));
+	vfloat z = r * r;
+
+	y = y + (((8.05374449538e-2f * z - 1.38776856032e-1f) * z + 1.99777106478e-1f) * z - 3.33329491539e-1f) * z * r + r;
+
+	return y ^ (x & vsign_bit()); // atan(inf) works out to PI/2 and nan propagates, so no fallback needed
+}
+
+// exp(x) for x in the range where 2^n is a normal float
+inline vfloat vexp_core (vfloat x) {
+	vint n = vint::round(x * 1.44269504088896341f);
+	vfloat fn = n.to_float();
+
+	x = (x - fn * 0.693359375f) - fn * -2.12194440e-4f;
+	vfloat z = x * x;
+
+	vfloat res = (((((1.9875691500e-4f * x + 1.3981999507e-3f) * x + 8.3334519073e-3f) * x
+		+ 4.1665795894e-2f) * x + 1.6666665459e-1f) * x + 5.0000001201e-1f) * z + x + 1.0f;
+
+	vfloat pow2n = (n + vint(127)).shl<23>().as_float();
+	return res * pow2n;
+}
+// log(x) for positive normal x
+inline vfloat vlog_core (vfloat x) {
+	vint bits = vint::bits(x);
+	vint e = bits.shr<23>() - vint(126);
+	vfloat m = ((bits & vint(0x807FFFFF)) | vint(0x3F000000)).as_float(); // mantissa in [0.5, 1)
+
+	// shift mantissa range to [sqrt(0.5), sqrt(2)) to keep the argument of the polynomial small
+	vfloat small = m < 0.707106781186547524f;
+	vfloat fe = e.to_float() - (vfloat(1.0f) & small);
+	m = (m + (m & small)) - 1.0f;
+
+	vfloat z = m * m;
+	vfloat y = ((((((((7.0376836292e-2f * m - 1.1514610310e-1f) * m + 1.1676998740e-1f) * m
+		- 1.2420140846e-1f) * m + 1.4249322787e-1f) * m - 1.6668057665e-1f) * m
+		+ 2.0000714765e-1f) * m - 2.4999993993e-1f) * m + 3.3333331174e-1f) * m * z;
+
+	y = y + fe * -2.12194440e-4f;
+	y = y - 0.5f * z;
+	return (m + y) + fe * 0.693359375f;
+}
+
+inline bool vexp_in_range (vfloat x) { return all((x >= -87.3f) & (x <= 88.3f)); }
+inline bool vlog_in_range (vfloat x) { return all((x >= 1.17549435e-38f) & (x <= 3.40282347e+38f)); }
+
+inline vfloat vexp (vfloat x) {
+	if (!vexp_in_range(x))
+		return vscalar(x, expf);
+	return vexp_core(x);
+}
+inline vfloat vlog (vfloat x) {
+	if (!vlog_in_range(x))
+		return vscalar(x, logf);
+	return vlog_core(x);
+}
+
+inline vfloat vpow (vfloat a, vfloat b) {
+	// negative bases (integer exponent sign rules), zero, inf and nan all go to powf
+	if (vlog_in_range(a)) {
+		vfloat e = b * vlog_core(a);
+		if (vexp_in_range(e))
+			return vexp_core(e);
+	}
+	return vscalar(a, b, powf);
+}
+
+#else
+
+inline vfloat vabs   (vfloat x) { return fabsf(x.v); }
+inline vfloat vsqrt  (vfloat x) { return sqrtf(x.v); }
+inline vfloat vmin   (vfloat a, vfloat b) { return min(a.v, b.v); }
+inline vfloat vmax   (vfloat a, vfloat b) { return max(a.v, b.v); }
+inline vfloat vsign  (vfloat x) { return mysign(x.v); }
+inline vfloat vfloor (vfloat x) { return floorf(x.v); }
+inline vfloat vceil  (vfloat x) { return ceilf(x.v); }
+inline vfloat vround (vfloat x) { return roundf(x.v); }
+inline vfloat vmod   (vfloat a, vfloat b) { return mymod(a.v, b.v); }
+inline vfloat vsin   (vfloat x) { return sinf(x.v); }
+inline vfloat vcos   (vfloat x) { return cosf(x.v); }
+inline vfloat vtan   (vfloat x) { return tanf(x.v); }
+inline vfloat vasin  (vfloat x) { return asinf(x.v); }
+inline vfloat vacos  (vfloat x) { return acosf(x.v); }
+inline vfloat vatan  (vfloat x) { return atanf(x.v); }
+inline vfloat vexp   (vfloat x) { return expf(x.v); }
+inline vfloat vlog   (vfloat x) { return logf(x.v); }
+inline vfloat vpow   (vfloat a, vfloat b) { return powf(a.v, b.v); }
+
+#endif